@@ -0,0 +1,197 @@
+// Parallel block compression of an output stream
+
+#include "BlockCompressor.h"
+#include <algorithm>
+#include <exception>
+#include <iostream>
+
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/filter/zstd.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+
+using namespace std;
+namespace io = boost::iostreams;
+
+BlockCompressor::BlockCompressor( ostream& os, ECompression compression,
+                                  size_t blocksize, unsigned int nthreads )
+  : m_os{os}
+  , m_compression{compression}
+  , m_blocksize{blocksize > 0 ? blocksize : DEFAULT_BLOCKSIZE}
+  , m_closed{false}
+  , m_status{0}
+  , m_fill{0}
+  , m_head{0}
+  , m_npending{0}
+  , m_writing{false}
+  , m_stop{false}
+{
+  if( nthreads == 0 )
+    nthreads = max(thread::hardware_concurrency()/2, 1u);
+  // One block being filled, one being written, the others being compressed
+  m_ring.resize(nthreads + 2);
+  for( unsigned int i = 0; i < nthreads; ++i )
+    m_workers.emplace_back(&BlockCompressor::Compress, this);
+}
+
+BlockCompressor::~BlockCompressor()
+{
+  Close();
+}
+
+int BlockCompressor::Write( const char* src, size_t len )
+{
+  if( m_closed )
+    return 1;
+  while( len > 0 ) {
+    // The other threads do not touch the block being filled
+    auto& blk = m_ring[m_fill];
+    if( blk.data.capacity() < m_blocksize )
+      blk.data.reserve(m_blocksize);
+    size_t n = min(len, m_blocksize - blk.data.size());
+    blk.data.insert(blk.data.end(), src, src + n);
+    src += n;
+    len -= n;
+    if( blk.data.size() == m_blocksize )
+      Submit();
+  }
+  lock_guard lock(m_mutex);
+  return m_status;
+}
+
+int BlockCompressor::Close()
+{
+  if( m_closed ) {
+    lock_guard lock(m_mutex);
+    return m_status;
+  }
+  m_closed = true;
+  unique_lock lock(m_mutex);
+  if( !m_ring[m_fill].data.empty() ) {
+    m_ring[m_fill].state = Block::kPending;
+    ++m_npending;
+    m_work.notify_one();
+  }
+  // Wait until all blocks are written, then stop the workers
+  m_free.wait(lock, [this] {
+    return all_of(m_ring.begin(), m_ring.end(), []( const Block& b ) {
+      return b.state == Block::kFree;
+    });
+  });
+  m_stop = true;
+  lock.unlock();
+  m_work.notify_all();
+  for( auto& t : m_workers )
+    t.join();
+  m_workers.clear();
+
+  m_os.flush();
+  if( !m_os.good() )
+    m_status = 1;
+  return m_status;
+}
+
+void BlockCompressor::Submit()
+{
+  // Hand the filled block to the workers and continue with the next one,
+  // once it has been written out
+
+  unique_lock lock(m_mutex);
+  m_ring[m_fill].state = Block::kPending;
+  ++m_npending;
+  m_work.notify_one();
+  m_fill = (m_fill + 1) % m_ring.size();
+  m_free.wait(lock, [this] { return m_ring[m_fill].state == Block::kFree; });
+}
+
+void BlockCompressor::Compress()
+{
+  // Compression thread. Compress pending blocks, earliest first, and write
+  // out those that are next in sequence.
+
+  for( ;; ) {
+    Block* blk = nullptr;
+    {
+      unique_lock lock(m_mutex);
+      m_work.wait(lock, [this] { return m_stop || m_npending > 0; });
+      if( m_npending == 0 )
+        return;
+      for( size_t i = 0; !blk; ++i ) {
+        auto& b = m_ring[(m_head + i) % m_ring.size()];
+        if( b.state == Block::kPending )
+          blk = &b;
+      }
+      blk->state = Block::kBusy;
+      --m_npending;
+    }
+
+    int status = CompressBlock(*blk);
+
+    unique_lock lock(m_mutex);
+    if( status != 0 )
+      m_status = status;
+    blk->state = Block::kReady;
+    WriteReady(lock);
+  }
+}
+
+int BlockCompressor::CompressBlock( Block& blk ) const
+{
+  // Compress blk.data into blk.output, as one gzip member or zstd frame
+
+  blk.output.clear();
+  try {
+    io::filtering_ostream out;
+    if( m_compression == kGzip )
+      out.push(io::gzip_compressor());
+    else
+      out.push(io::zstd_compressor());
+    out.push(io::back_inserter(blk.output));
+    out.write( blk.data.data(), streamsize(blk.data.size()) );
+    // Flush and write the trailer
+    out.reset();
+  }
+  catch( const exception& e ) {
+    cerr << "Error compressing output: " << e.what() << endl;
+    blk.output.clear();
+    return 1;
+  }
+  return 0;
+}
+
+void BlockCompressor::WriteReady( unique_lock<mutex>& lock )
+{
+  // Write the compressed blocks at the head of the ring to the stream.
+  // One thread at a time does this. The others leave their blocks to it.
+
+  if( m_writing )
+    return;
+  m_writing = true;
+  while( m_ring[m_head].state == Block::kReady ) {
+    auto& blk = m_ring[m_head];
+    lock.unlock();
+    m_os.write( blk.output.data(), streamsize(blk.output.size()) );
+    bool ok = m_os.good();
+    lock.lock();
+    if( !ok )
+      m_status = 1;
+    blk.data.clear();
+    blk.state = Block::kFree;
+    m_head = (m_head + 1) % m_ring.size();
+    m_free.notify_all();
+  }
+  m_writing = false;
+}
+
+streamsize BlockCompressor::Sink::write( const char* s, streamsize n )
+{
+  if( m_c->Write(s, size_t(n)) != 0 )
+    throw ios_base::failure("Error writing compressed output");
+  return n;
+}
+
+void BlockCompressor::Sink::close()
+{
+  if( m_c->Close() != 0 )
+    cerr << "Error writing compressed output" << endl;
+}
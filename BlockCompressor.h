@@ -0,0 +1,89 @@
+// Parallel block compression of an output stream
+//
+// The data written are cut into blocks of a fixed size, which a set of
+// worker threads compress independently, as gzip members or zstd frames.
+// The compressed blocks are written to the underlying stream in order, so
+// the result is a regular .gz or .zst file that standard tools can read.
+// The writer only waits if all blocks are still being compressed or
+// written.
+
+#ifndef PPODD_BLOCKCOMPRESSOR
+#define PPODD_BLOCKCOMPRESSOR
+
+#include <boost/iostreams/categories.hpp>
+#include <condition_variable>
+#include <iosfwd>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class BlockCompressor {
+public:
+  enum ECompression { kGzip, kZstd };
+
+  static constexpr size_t DEFAULT_BLOCKSIZE = 1024*1024;
+
+  // Compress to 'os' in format 'compression'. 'nthreads' is the number of
+  // compression threads (0 = half the number of hardware threads)
+  BlockCompressor( std::ostream& os, ECompression compression,
+                   size_t blocksize = DEFAULT_BLOCKSIZE,
+                   unsigned int nthreads = 0 );
+  ~BlockCompressor();
+  BlockCompressor( const BlockCompressor& ) = delete;
+  BlockCompressor& operator=( const BlockCompressor& ) = delete;
+
+  // Append 'len' bytes at 'src'. Returns 0 on success, 1 if writing to the
+  // underlying stream has failed.
+  int Write( const char* src, size_t len );
+
+  // Compress and write any remaining data and stop the threads. Returns 0
+  // on success, 1 on error. Further writes fail.
+  int Close();
+
+  // boost::iostreams sink writing to this compressor, to terminate a
+  // filter chain. Closing the chain closes the compressor.
+  class Sink {
+  public:
+    using char_type = char;
+    struct category : boost::iostreams::sink_tag,
+                      boost::iostreams::closable_tag {};
+    explicit Sink( BlockCompressor& c ) : m_c(&c) {}
+    std::streamsize write( const char* s, std::streamsize n );
+    void close();
+  private:
+    BlockCompressor* m_c;
+  };
+  Sink GetSink() { return Sink(*this); }
+
+private:
+  struct Block {
+    enum EState { kFree, kPending, kBusy, kReady };
+    std::vector<char> data;    // Uncompressed
+    std::vector<char> output;  // Compressed
+    EState state{kFree};
+  };
+
+  std::ostream& m_os;
+  ECompression  m_compression;
+  size_t        m_blocksize;
+  bool          m_closed;
+  int           m_status;
+
+  std::vector<Block> m_ring;
+  size_t       m_fill;     // Block being filled by the writer
+  size_t       m_head;     // Next block to be written to m_os
+  size_t       m_npending; // Blocks waiting for compression
+  bool         m_writing;  // A thread is writing blocks to m_os
+  bool         m_stop;     // Request for the workers to exit
+  std::vector<std::thread> m_workers;
+  std::mutex   m_mutex;
+  std::condition_variable m_work;
+  std::condition_variable m_free;
+
+  void Submit();
+  void Compress();
+  int  CompressBlock( Block& blk ) const;
+  void WriteReady( std::unique_lock<std::mutex>& lock );
+};
+
+#endif
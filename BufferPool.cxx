@@ -0,0 +1,81 @@
+// Pool of event buffers in power-of-two size classes
+
+#include "BufferPool.h"
+#include <algorithm>
+#include <iostream>
+
+using namespace std;
+
+BufferPool& BufferPool::Instance()
+{
+  static BufferPool pool;
+  return pool;
+}
+
+BufferPool::~BufferPool()
+{
+  for( auto& sc : m_classes ) {
+    for( auto* buf : sc.free )
+      delete [] buf;
+  }
+}
+
+BufferPool::Buffer BufferPool::Get( size_t nwords )
+{
+  // Find the smallest size class holding 'nwords'
+  unsigned cl = MIN_CLASS;
+  while( cl < MAX_CLASS && (size_t(1) << cl) < nwords )
+    ++cl;
+  if( (size_t(1) << cl) < nwords )
+    throw bad_alloc();
+
+  size_t nbytes = (size_t(1) << cl) * sizeof(evbuf_t);
+  evbuf_t* buf = nullptr;
+  {
+    lock_guard lock(m_mutex);
+    auto& sc = m_classes[cl - MIN_CLASS];
+    if( !sc.free.empty() ) {
+      buf = sc.free.back();
+      sc.free.pop_back();
+    } else {
+      ++sc.nalloc;
+      m_bytes += nbytes;
+    }
+    sc.maxuse = max(sc.maxuse, ++sc.inuse);
+    m_inuse_bytes += nbytes;
+    m_maxuse_bytes = max(m_maxuse_bytes, m_inuse_bytes);
+  }
+  if( !buf )
+    buf = new evbuf_t[size_t(1) << cl];
+  buf[0] = 0;
+  return Buffer(buf, Deleter(cl));
+}
+
+void BufferPool::Release( evbuf_t* buf, unsigned sizeclass )
+{
+  lock_guard lock(m_mutex);
+  auto& sc = m_classes[sizeclass - MIN_CLASS];
+  sc.free.push_back(buf);
+  --sc.inuse;
+  m_inuse_bytes -= (size_t(1) << sizeclass) * sizeof(evbuf_t);
+}
+
+void BufferPool::Deleter::operator()( evbuf_t* buf ) const
+{
+  if( buf )
+    Instance().Release(buf, m_class);
+}
+
+void BufferPool::Print() const
+{
+  lock_guard lock(m_mutex);
+  cout << "Event buffers: " << m_bytes / 1024 << " kB allocated, "
+       << "max " << m_maxuse_bytes / 1024 << " kB in use" << endl;
+  for( unsigned cl = MIN_CLASS; cl <= MAX_CLASS; ++cl ) {
+    const auto& sc = m_classes[cl - MIN_CLASS];
+    if( sc.nalloc == 0 )
+      continue;
+    cout << "  " << (size_t(1) << cl) * sizeof(evbuf_t) << " bytes: "
+         << sc.nalloc << " allocated, max " << sc.maxuse << " in use" << endl;
+  }
+}
@@ -0,0 +1,82 @@
+// Pool of event buffers in power-of-two size classes
+//
+// Event buffers are handed out sized to the event being read, rounded up to
+// the next size class, instead of at the maximum event size. Released
+// buffers are kept on a free list per size class and reused. Buffers are
+// only ever replaced by larger ones, so a buffer that is swapped between
+// readers and analysis contexts settles at the size of the largest event
+// it has held, and large allocations happen only for rare large events.
+
+#ifndef PPODD_BUFFERPOOL
+#define PPODD_BUFFERPOOL
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using evbuf_t = uint32_t;
+
+class BufferPool {
+public:
+  static constexpr unsigned MIN_CLASS = 6;   // 64 words
+  static constexpr unsigned MAX_CLASS = 22;  // 4M words = MAX_EVTSIZE
+  static constexpr unsigned NCLASSES = MAX_CLASS - MIN_CLASS + 1;
+
+  // Deleter for buffers from the pool. Returns the buffer to its free list.
+  class Deleter {
+  public:
+    Deleter() = default;
+    [[nodiscard]] size_t capacity() const {   // Words
+      return m_class ? (size_t(1) << m_class) : 0;
+    }
+    void operator()( evbuf_t* buf ) const;
+  private:
+    friend class BufferPool;
+    explicit Deleter( unsigned sizeclass ) : m_class(sizeclass) {}
+    unsigned m_class{0};
+  };
+
+  using Buffer = std::unique_ptr<evbuf_t[], Deleter>;
+
+  // The process-wide pool
+  static BufferPool& Instance();
+
+  // Get a buffer of at least 'nwords' words
+  Buffer Get( size_t nwords );
+
+  // Replace 'buf' with a larger buffer if it holds fewer than 'nwords'
+  // words. Existing contents are not preserved.
+  static void Reserve( Buffer& buf, size_t nwords ) {
+    if( buf.get_deleter().capacity() < nwords )
+      buf = Instance().Get(nwords);
+  }
+
+  // Print buffer usage statistics and high-water marks
+  void Print() const;
+
+  BufferPool( const BufferPool& ) = delete;
+  BufferPool& operator=( const BufferPool& ) = delete;
+  ~BufferPool();
+
+private:
+  BufferPool() = default;
+
+  struct SizeClass {
+    std::vector<evbuf_t*> free;
+    size_t nalloc{0};    // Buffers allocated
+    size_t inuse{0};     // Buffers handed out
+    size_t maxuse{0};    // High-water mark of inuse
+  };
+
+  mutable std::mutex m_mutex;
+  SizeClass m_classes[NCLASSES];
+  size_t m_bytes{0};        // Total bytes allocated
+  size_t m_inuse_bytes{0};  // Bytes handed out
+  size_t m_maxuse_bytes{0}; // High-water mark of m_inuse_bytes
+
+  void Release( evbuf_t* buf, unsigned sizeclass );
+};
+
+#endif
@@ -4,13 +4,20 @@
 #include "Detector.h"
 #include "Variable.h"
 #include "Util.h"
+#ifdef PPODD_TBB
+#include <oneapi/tbb/task_group.h>
+#else
+#include "ThreadPool.hpp"
+#endif
 
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <iostream>
-#include <fstream>
-#include <boost/algorithm/string/trim.hpp>
+#include <string_view>
+#include <unordered_map>
 
 using namespace std;
-using namespace boost::algorithm;
 
 Context::Context( int _id )
   : id(_id), is_init(false), is_active(false)
@@ -46,51 +53,285 @@ int Context::Init()
   if( err )
     return 1;
 
-  // Read output definitions & configure output
-  outvars.push_back( make_unique<EventNumberVariable>(nev) );
-
-  string ofname = cfg.odef_file;
-  if( ofname.empty() )
+  // Output definitions. They are the same for all contexts, so the odef
+  // file is read and matched only once.
+  {
+    lock_guard lock(fgSchemaMutex);
+    if( !fgSchema && !(fgSchema = OutputSchema::Compile(cfg.odef_file, *variables)) )
+      return 2;
+    schema = fgSchema;
+  }
+  if( !schema->Bind(*variables, outlocs) )
     return 2;
 
-  ifstream inp(ofname);
-  if( !inp ) {
-    cerr << "Error opening output definition file " << ofname << endl;
-    return 2;
+  // Detectors with output variables need to be analyzed, and so do,
+  // recursively, the detectors whose variables they use as input. Only the
+  // modules they read need to be decoded.
+  const auto ndet = detectors.size();
+  unordered_map<string_view, size_t> detindex;
+  for( size_t k = 0; k < ndet; ++k )
+    detindex.emplace(detectors[k]->GetName(), k);
+  // Index of the detector owning variable 'varname' ("<detector>.<var>"),
+  // or ndet if none
+  auto owner = [&detindex, ndet]( string_view varname ) {
+    for( auto dot = varname.find('.'); dot != string_view::npos;
+         dot = varname.find('.', dot+1) ) {
+      if( auto it = detindex.find(varname.substr(0, dot)); it != detindex.end() )
+        return it->second;
+    }
+    return ndet;
+  };
+  vector<bool> needed(ndet, false);
+  vector<size_t> work;
+  for( const auto& col : schema->GetColumns() ) {
+    if( auto k = owner(col.GetName()); k < ndet && !needed[k] ) {
+      needed[k] = true;
+      work.push_back(k);
+    }
+  }
+  // uses[k]: producers of the inputs of detectors[k]; invars[k]: the inputs
+  vector<vector<size_t>> uses(ndet);
+  vector<vector<const Variable*>> invars(ndet);
+  while( !work.empty() ) {
+    auto k = work.back();
+    work.pop_back();
+    for( const auto& name : detectors[k]->GetInputs() ) {
+      const auto* var = variables->Find(name);
+      auto p = owner(name);
+      if( !var || p == ndet || p == k ) {
+        cerr << "Detector " << detectors[k]->GetName()
+             << ": invalid input variable " << name << endl;
+        return 4;
+      }
+      invars[k].push_back(var);
+      if( find(ALL(uses[k]), p) == uses[k].end() )
+        uses[k].push_back(p);
+      if( !needed[p] ) {
+        needed[p] = true;
+        work.push_back(p);
+      }
+    }
   }
 
-  string line;
-  while( getline(inp,line) ) {
-    // Wildcard match variable names, ignoring trailing comments
-    if( string::size_type pos = line.find('#'); pos != string::npos )
-      line.erase(pos);
-    trim(line);
-    if( line.empty() )
-      continue;
-    for( auto& var : *variables ) {
-      if( WildcardMatch(var->GetName(), line) )
-	outvars.push_back( make_unique<PlainVariable>(var.get()) );
+  // Order the needed detectors so that each comes after the ones it uses
+  active.clear();
+  vector<size_t> order;               // Indices in 'detectors'
+  vector<size_t> pos(ndet, ndet);     // Position in 'active'
+  vector<size_t> ndeps(ndet, 0);
+  for( size_t k = 0; k < ndet; ++k ) {
+    if( needed[k] && (ndeps[k] = uses[k].size()) == 0 )
+      order.push_back(k);
+  }
+  for( size_t i = 0; i < order.size(); ++i ) {
+    pos[order[i]] = i;
+    for( size_t k = 0; k < ndet; ++k ) {
+      if( needed[k] && find(ALL(uses[k]), order[i]) != uses[k].end() &&
+          --ndeps[k] == 0 )
+        order.push_back(k);
+    }
+  }
+  if( order.size() != size_t(count(ALL(needed), true)) ) {
+    cerr << "Circular dependency among detectors:";
+    for( size_t k = 0; k < ndet; ++k ) {
+      if( needed[k] && pos[k] == ndet )
+        cerr << " " << detectors[k]->GetName();
+    }
+    cerr << endl;
+    return 4;
+  }
+  det_next.assign(order.size(), {});
+  det_ndeps.assign(order.size(), 0);
+  vector<int> modules;
+  for( size_t i = 0; i < order.size(); ++i ) {
+    auto k = order[i];
+    active.push_back(detectors[k].get());
+    modules.push_back(detectors[k]->GetModule());
+    det_ndeps[i] = uses[k].size();
+    for( auto p : uses[k] )
+      det_next[pos[p]].push_back(i);
+  }
+  det_pending = make_unique<atomic<size_t>[]>(active.size());
+  if( debug > 0 && id == 0 ) {
+    for( size_t k = 0; k < ndet; ++k ) {
+      if( !needed[k] )
+        cout << "Detector " << detectors[k]->GetName() << " has no output, skipped" << endl;
     }
   }
-  line.clear();
-  inp.close();
 
-  if( outvars.empty() ) {
-    // Noting to do
-    cerr << "No output variables defined. Check " << ofname << endl;
-    return 3;
+  // The detectors store their output variables directly in the result
+  // rows, at the offsets of the output record. Inputs of other detectors
+  // that are not output follow the record.
+  const auto& columns = schema->GetColumns();
+  rowsize = schema->GetRowSize();
+  unordered_map<const double*, vector<size_t>> outoffsets;  // By location
+  for( size_t col = 0; col < columns.size(); ++col ) {
+    if( const auto* loc = outlocs[col] )
+      outoffsets[loc].push_back(columns[col].offset);
+  }
+  for( auto* det : active ) {
+    for( const auto* var : variables->FindPrefix(det->GetName() + '.') ) {
+      if( auto it = outoffsets.find(var->GetLocation()); it != outoffsets.end() ) {
+        for( auto offset : it->second )
+          det->AddOutput(offset, var->GetLocation());
+      }
+    }
   }
+  unordered_map<const Variable*, size_t> inoffsets;
+  for( auto k : order ) {
+    for( size_t j = 0; j < invars[k].size(); ++j ) {
+      const auto* var = invars[k][j];
+      size_t offset;
+      if( auto it = outoffsets.find(var->GetLocation()); it != outoffsets.end() ) {
+        offset = it->second.front();
+      } else {
+        auto [io, added] = inoffsets.emplace(var, rowsize);
+        if( added ) {
+          detectors[owner(var->GetName())]->AddOutput(rowsize, var->GetLocation());
+          rowsize += sizeof(double);
+        }
+        offset = io->second;
+      }
+      detectors[k]->SetInputOffset(j, offset);
+    }
+  }
+
+  // Event batch. Event buffers are swapped in from the input when reading.
+  size_t nmax = max<size_t>(cfg.batch_size, 1);
+  nevents = 0;
+  evbuffer.resize(nmax);
+  evptr.assign(nmax, nullptr);
+  evnum.assign(nmax, 0);
+  evdata.resize(nmax);
+  for( auto& dec : evdata )
+    dec.SetModules(modules);
+  results.assign((nmax * rowsize + sizeof(CacheLine) - 1) / sizeof(CacheLine),
+                 CacheLine{});
+  det_cost.assign(active.size(), 0);
+  det_async.assign(active.size(), false);
 
+  is_init = true;
+  return 0;
+}
+
+void Context::Analyze()
+{
+  for( size_t i = 0; i < nevents; ++i ) {
+    //TODO: add error status to context, let output skip bad results
+    if( int status = evdata[i].Load(evptr[i]) ) {
+      cerr << "Decoding error = " << status
+           << " at event " << evnum[i] << endl;
+      evdata[i].Clear();
+    }
+  }
+
+  // The event number is the first output column, see Init()
+  ResultRows rows{ results.data()->bytes, rowsize };
+  for( size_t i = 0; i < nevents; ++i ) {
+    auto ev = static_cast<int>(evnum[i]);
+    memcpy(rows[i], &ev, sizeof(ev));
+  }
+
+  Span<Decoder> batch{ evdata.data(), nevents };
 #ifndef PPODD_TBB
-  if( !evbuffer )
-    evbuffer = make_unique<evbuf_t[]>(MAX_EVTSIZE);
-  evbuffer[0] = 0;
+  if( !task_pool ) {
+#else
+  if( cfg.task_threshold < 0 ) {
 #endif
+    // 'active' is in dependency order
+    for( auto* det : active )
+      det->AnalyzeBatch(batch, rows);
+    return;
+  }
 
-  is_init = true;
+  // Detectors write to their own result columns. Each starts once the
+  // detectors whose results it uses are done. Those that took at least
+  // cfg.task_threshold us per batch on average run as concurrent tasks.
+  // Cheaper ones, for which a task would cost more than it saves, run
+  // inline in the thread that starts them.
+
+  // Decide before starting, since the tasks update det_cost. The counts of
+  // pending dependencies are reset for every batch. If a detector throws,
+  // wait() rethrows, and the detectors depending on it have not run.
+  size_t ntasks = 0;
+  for( size_t k = 0; k < active.size(); ++k ) {
+    det_async[k] = det_cost[k] >= cfg.task_threshold;
+    ntasks += det_async[k];
+    det_pending[k].store(det_ndeps[k], memory_order_relaxed);
+  }
+  if( ntasks == 0 ) {
+    for( size_t k = 0; k < active.size(); ++k )
+      AnalyzeDetector(k, batch, rows);
+    return;
+  }
+#ifdef PPODD_TBB
+  tbb::task_group tasks;
+#else
+  ThreadUtil::TaskGroup tasks(*task_pool);
+#endif
+  // Start the tasks first, so that they overlap with the inline detectors
+  for( size_t k = 0; k < active.size(); ++k ) {
+    if( det_ndeps[k] == 0 && det_async[k] )
+      tasks.run([this, &tasks, k, batch, rows] { RunDetector(k, tasks, batch, rows); });
+  }
+  for( size_t k = 0; k < active.size(); ++k ) {
+    if( det_ndeps[k] == 0 && !det_async[k] )
+      RunDetector(k, tasks, batch, rows);
+  }
+  tasks.wait();
+}
+
+void Context::AnalyzeDetector( size_t k, Span<Decoder> batch, ResultRows rows )
+{
+  auto start = chrono::steady_clock::now();
+  active[k]->AnalyzeBatch(batch, rows);
+  chrono::duration<double, micro> us = chrono::steady_clock::now() - start;
+  det_cost[k] = det_cost[k] > 0 ? 0.9*det_cost[k] + 0.1*us.count() : us.count();
+}
+
+template<typename Tasks>
+void Context::RunDetector( size_t k, Tasks& tasks, Span<Decoder> batch,
+                           ResultRows rows )
+{
+  AnalyzeDetector(k, batch, rows);
+  // The last of the detectors used by 'next' to finish starts it. The
+  // acq_rel ordering makes the results of all of them visible to it.
+  for( auto next : det_next[k] ) {
+    if( det_pending[next].fetch_sub(1, memory_order_acq_rel) != 1 )
+      continue;
+    if( det_async[next] )
+      tasks.run([this, &tasks, next, batch, rows] { RunDetector(next, tasks, batch, rows); });
+    else
+      RunDetector(next, tasks, batch, rows);
+  }
+}
+
+int Context::ReadBatch( PartitionedInput::Cursor& cursor )
+{
+  nevents = 0;
+  while( !IsFull() ) {
+    // Mapped event data become invalid when the cursor switches files.
+    // End the batch there.
+    if( nevents > 0 && cursor.GetFile().IsMapped() && !cursor.NextInSameFile() )
+      break;
+    if( int status = cursor.ReadEvent(); status != 0 )
+      return status;
+    AddEvent(cursor.GetFile(), cursor.GetEvnum());
+  }
   return 0;
 }
 
+void Context::Serialize( OutputChunk& chunk ) const
+{
+  // Keep the chunk's capacity; chunks are recycled
+  chunk.data.clear();
+  AppendRows(chunk.data, *schema, GetResults(), nevents, rowsize);
+  chunk.evnum.assign(evnum.begin(), evnum.begin() + ptrdiff_t(nevents));
+  chunk.iseq = iseq;
+}
+
+mutex Context::fgSchemaMutex;
+shared_ptr<const OutputSchema> Context::fgSchema;
+
 #ifdef EVTORDER
 int Context::fgNactive = 0;
 std::mutex Context::fgMutex;
@@ -122,9 +363,11 @@ void Context::WaitAllDone()
     fgAllDone.wait(lock);
 }
 
+// Sync events are always processed on their own, see ppodd.cxx
 bool Context::IsSyncEvent()
 {
-  evdata.Preload( evbuffer.get() );
-  return evdata.IsSyncEvent();
+  assert( nevents == 1 );
+  evdata[0].Preload( evptr[0] );
+  return evdata[0].IsSyncEvent();
 }
 #endif
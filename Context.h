@@ -6,11 +6,20 @@
 #include "Podd.h"
 #include "Decoder.h"
 #include "Output.h"
+#include "PartitionedInput.h"
+#include "Util.h"
+#include <atomic>
 #include <thread>
 #include <functional>
 #include <cassert>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <utility>
+#include <vector>
+
+struct ResultRows;
+namespace ThreadUtil { class TaskPool; }
 
 class Context {
 public:
@@ -20,6 +29,29 @@ public:
   ~Context();
 
   int Init();
+
+  // Decode and analyze the batch of events held by this context. Events
+  // that cannot be decoded are analyzed as empty events. With
+  // cfg.task_threshold >= 0, independent detectors run concurrently, see
+  // Context.cxx.
+  void Analyze();
+
+  // Append the current event of 'file' (a DataFile or FileChain) with
+  // number 'evnum' to the batch. Events from mapped files are referenced
+  // in place. Otherwise, the file's event buffer is taken over.
+  template<typename File>
+  void AddEvent( File& file, size_t evnum );
+
+  // Fill the batch with the next events of 'cursor'. Returns 0 on success,
+  // -1 if the cursor ran out of events, > 0 on error. In the latter cases,
+  // the batch may be partially filled.
+  int ReadBatch( PartitionedInput::Cursor& cursor );
+
+  [[nodiscard]] size_t GetBatchSize() const { return evptr.size(); }
+  [[nodiscard]] const char* GetResults() const { return results.data()->bytes; }
+  // Copy the output records of the batch into 'chunk', replacing its contents
+  void Serialize( OutputChunk& chunk ) const;
+  [[nodiscard]] bool   IsFull()       const { return nevents == evptr.size(); }
 #ifdef EVTORDER
   void MarkActive();
   void UnmarkActive();
@@ -27,22 +59,50 @@ public:
   bool IsSyncEvent();
 #endif
 
-  // Per-thread data
-#ifndef PPODD_TBB
-  evbuf_ptr_t evbuffer;  // Event buffer read from file
-#endif
-  Decoder   evdata;      // Decoded data
+  // Per-thread data. A context carries a batch of up to GetBatchSize()
+  // events (cfg.batch_size), of which the first 'nevents' are in use.
+  size_t    nevents{};   // Number of events in the batch
+  std::vector<evbuf_ptr_t>    evbuffer; // Event buffers taken from the input
+  std::vector<const evbuf_t*> evptr;    // Events: evbuffer or mapped file data
+  std::vector<size_t>         evnum;    // Event numbers
+  std::vector<Decoder>        evdata;   // Decoded data
+  // Results, one row per event (see ResultRows). The block is aligned to
+  // cache lines, so that analysis threads filling different contexts
+  // never share cache lines.
+  std::vector<CacheLine>      results;
   detlst_t  detectors;   // Detectors with private event-by-event data
+  std::vector<Detector*> active; // Detectors needed, in dependency order
+  std::vector<std::vector<size_t>> det_next; // Users of the results of active[k]
+  std::vector<size_t> det_ndeps; // Number of detectors active[k] uses
+  std::unique_ptr<std::atomic<size_t>[]> det_pending; // Of these, not yet done
+  std::vector<double> det_cost;  // Average analysis time of 'active' (us/batch)
+  std::vector<bool>   det_async; // Run as a concurrent task in this batch
+  size_t    rowsize{};   // Size of a result row (bytes): output record, then
+                         // other detector inputs
+  ThreadUtil::TaskPool* task_pool{}; // Runs concurrent detectors (without TBB)
+  std::unique_ptr<OutputChunk> output; // Receives the output records of the
+                                       // batch (without TBB)
   std::shared_ptr<varlst_t> variables;   // Interface to analysis results
-  voutp_t   outvars;     // Output definitions
-  size_t    nev{};       // Event number given to this thread
-  size_t    iseq{};      // Event sequence number
+  std::shared_ptr<const OutputSchema> schema; // Output definitions
+  std::vector<const double*> outlocs;  // Our values of the schema's columns
+  size_t    iseq{};      // Batch sequence number
   int       id{};        // This context's ID
   bool      is_init;     // Init() called successfully
   bool      is_active;   // Currently being processed in a worker thread
   ClockTime_t m_time_spent{}; // Analysis time sum
 
 private:
+  // The output schema is compiled by the first context and shared
+  static std::mutex fgSchemaMutex;
+  static std::shared_ptr<const OutputSchema> fgSchema;
+
+  // Analyze the batch with detector active[k] and update its det_cost
+  void AnalyzeDetector( size_t k, Span<Decoder> batch, ResultRows rows );
+  // Analyze detector active[k], then start those of its users that have
+  // no other pending dependencies
+  template<typename Tasks>
+  void RunDetector( size_t k, Tasks& tasks, Span<Decoder> batch, ResultRows rows );
+
 #ifdef EVTORDER
   static std::mutex fgMutex;
   static std::condition_variable fgAllDone;
@@ -50,4 +110,19 @@ private:
 #endif
 };
 
+template<typename File>
+void Context::AddEvent( File& file, size_t num )
+{
+  assert( nevents < evptr.size() );
+  if( file.IsMapped() ) {
+    evptr[nevents] = file.GetEvBufPtr();
+  } else {
+    // The file enlarges the buffer it gets in exchange as needed
+    std::swap(evbuffer[nevents], file.GetEvBuffer());
+    evptr[nevents] = evbuffer[nevents].get();
+  }
+  evnum[nevents] = num;
+  ++nevents;
+}
+
 #endif
@@ -0,0 +1,76 @@
+// CRC-32C (Castagnoli) checksum
+
+#include "Crc32c.h"
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#define PPODD_CRC32C_HW
+#endif
+
+// Reflected polynomial
+static constexpr uint32_t POLY = 0x82F63B78U;
+
+// Lookup tables for processing 8 bytes per step ("slicing-by-8")
+struct Crc32cTable {
+  uint32_t t[8][256];
+  Crc32cTable() {
+    for( uint32_t i = 0; i < 256; ++i ) {
+      uint32_t c = i;
+      for( int k = 0; k < 8; ++k )
+        c = (c & 1) ? (c >> 1) ^ POLY : (c >> 1);
+      t[0][i] = c;
+    }
+    for( uint32_t i = 0; i < 256; ++i )
+      for( int k = 1; k < 8; ++k )
+        t[k][i] = (t[k-1][i] >> 8) ^ t[0][t[k-1][i] & 0xFF];
+  }
+};
+
+static uint32_t crc32c_sw( const unsigned char* p, size_t len, uint32_t crc )
+{
+  static const Crc32cTable table;
+  const auto& t = table.t;
+
+  for( ; len >= 8; p += 8, len -= 8 ) {
+    uint64_t w;
+    memcpy( &w, p, 8 );
+    w ^= crc;
+    crc = t[7][ w        & 0xFF] ^ t[6][(w >>  8) & 0xFF] ^
+          t[5][(w >> 16) & 0xFF] ^ t[4][(w >> 24) & 0xFF] ^
+          t[3][(w >> 32) & 0xFF] ^ t[2][(w >> 40) & 0xFF] ^
+          t[1][(w >> 48) & 0xFF] ^ t[0][ w >> 56        ];
+  }
+  while( len-- )
+    crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xFF];
+  return crc;
+}
+
+#ifdef PPODD_CRC32C_HW
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw( const unsigned char* p, size_t len, uint32_t crc )
+{
+  uint64_t c = crc;
+  for( ; len >= 8; p += 8, len -= 8 ) {
+    uint64_t w;
+    memcpy( &w, p, 8 );
+    c = _mm_crc32_u64( c, w );
+  }
+  auto c32 = static_cast<uint32_t>(c);
+  while( len-- )
+    c32 = _mm_crc32_u8( c32, *p++ );
+  return c32;
+}
+#endif
+
+uint32_t Crc32c( const void* data, size_t len, uint32_t crc )
+{
+  const auto* p = static_cast<const unsigned char*>(data);
+  crc = ~crc;
+#ifdef PPODD_CRC32C_HW
+  static const bool have_sse42 = __builtin_cpu_supports("sse4.2");
+  if( have_sse42 )
+    return ~crc32c_hw( p, len, crc );
+#endif
+  return ~crc32c_sw( p, len, crc );
+}
@@ -0,0 +1,16 @@
+// CRC-32C (Castagnoli) checksum, as used for the blocks of raw data files
+//
+// Uses the SSE4.2 crc32 instruction if the CPU supports it, otherwise
+// a table-driven implementation.
+
+#ifndef PPODD_CRC32C
+#define PPODD_CRC32C
+
+#include <cstdint>
+#include <cstddef>
+
+// Checksum of 'len' bytes at 'data'. To checksum data in pieces, pass the
+// result for the preceding pieces as 'crc'.
+uint32_t Crc32c( const void* data, size_t len, uint32_t crc = 0 );
+
+#endif
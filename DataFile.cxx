@@ -1,19 +1,60 @@
 // Interface for reading a data file for parallelization test
 
 #include "DataFile.h"
+#include "Crc32c.h"
+#include <algorithm>
 #include <iostream>
 #include <memory>
+#include <cerrno>
+#include <cstring>    // for strerror
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 using namespace std;
 
-DataFile::DataFile( string fname )
+// Event returned before anything has been read
+static const evbuf_t null_event[2] = {0, 0};
+
+// Size of the region ahead of the current read position that we ask the
+// kernel to prefetch when reading a mapped file. Must be a multiple of the
+// page size.
+static constexpr size_t MMAP_WILLNEED = 64*1024*1024;
+
+// Validate header of a blocked file. Returns 0 if it is usable.
+static int CheckFileHeader( const RawFileHeader& hdr, const string& filename )
+{
+  if( hdr.version != RAWFILE_VERSION || hdr.header_size < sizeof(hdr) ) {
+    cerr << "Unsupported raw data format version " << hdr.version
+         << " in file " << filename << endl;
+    return 5;
+  }
+  return 0;
+}
+
+DataFile::DataFile( string fname, EReadMode _mode )
   : filename{std::move(fname)}
+  , mode{kStdio}
   , filep{nullptr}
-  , buffer{make_unique<evbuf_t[]>(MAX_EVTSIZE)}
+  , evptr{null_event}
+  , mapfd{-1}
+  , mapbase{nullptr}
+  , mapsize{0}
+  , mappos{0}
+  , mapadvised{0}
+  , blocksize{ReadAhead::DEFAULT_BLOCKSIZE}
+  , nthreads{0}
+  , format{0}
+  , blkptr{nullptr}
+  , blkend{nullptr}
+  , blkleft{0}
+  , blocks_end{0}
+  , scanstat{-1}
 {
   // Constructor
 
-  buffer[0] = 0;
+  SetReadMode(_mode);
 }
 
 DataFile::~DataFile()
@@ -23,11 +64,35 @@ DataFile::~DataFile()
   Close();
 }
 
+void DataFile::SetReadMode( EReadMode _mode )
+{
+  // Set method for reading the file. Takes effect at the next Open().
+  // The event buffer for kStdio and kPrefetch is allocated when reading,
+  // sized to the event.
+
+  mode = _mode;
+}
+
 int DataFile::Open( const string& fname )
 {
   if( !fname.empty() )
     filename = fname;
 
+  iostats = {};
+  ResetFormat();
+  blocks.clear();
+  scanstat = -1;
+  // Compressed files are always decompressed by a read-ahead thread.
+  // (Compressed pipes are only detected in kPrefetch mode.)
+  if( mode == kPrefetch ||
+      ReadAhead::DetectCompression(filename) != ReadAhead::kNone ) {
+    prefetch = make_unique<ReadAhead>(blocksize, nthreads);
+    return prefetch->Open(filename);
+  }
+
+  if( mode == kMmap )
+    return OpenMapped();
+
   filep = fopen( filename.c_str(), "r" );
   if( !filep ) {
     cerr << "Error opening file " << filename << endl;
@@ -37,12 +102,241 @@ int DataFile::Open( const string& fname )
   return 0;
 }
 
+int DataFile::OpenMapped()
+{
+  // Map the entire file read-only into memory
+
+  mapfd = open( filename.c_str(), O_RDONLY );
+  if( mapfd < 0 ) {
+    cerr << "Error opening file " << filename << endl;
+    return 1;
+  }
+  struct stat st{};
+  if( fstat(mapfd, &st) != 0 ) {
+    cerr << "Cannot stat file " << filename << ": " << strerror(errno) << endl;
+    Close();
+    return 1;
+  }
+  mapsize = st.st_size;
+  mappos = mapadvised = 0;
+  if( mapsize > 0 ) {
+    void* addr = mmap( nullptr, mapsize, PROT_READ, MAP_PRIVATE, mapfd, 0 );
+    if( addr == MAP_FAILED ) {
+      cerr << "Cannot map file " << filename << ": " << strerror(errno) << endl;
+      Close();
+      return 1;
+    }
+    mapbase = static_cast<const char*>(addr);
+    // We walk the file front to back exactly once
+    madvise( addr, mapsize, MADV_SEQUENTIAL );
+  }
+
+  return 0;
+}
+
 int DataFile::Close()
 {
   if( filep ) {
     fclose(filep);
     filep = nullptr;
   }
+  if( mapbase ) {
+    munmap( const_cast<char*>(mapbase), mapsize );
+    mapbase = nullptr;
+  }
+  if( mapfd >= 0 ) {
+    close(mapfd);
+    mapfd = -1;
+  }
+  mapsize = mappos = mapadvised = 0;
+  prefetch.reset();
+  evptr = buffer ? buffer.get() : null_event;
+  ResetFormat();
+  blockbuf.clear();
+  blockbuf.shrink_to_fit();
+  return 0;
+}
+
+void DataFile::ResetFormat()
+{
+  // Determine the file format anew at the next ReadEvent(), which must
+  // read from the beginning of the file
+
+  format = 0;
+  blkptr = blkend = nullptr;
+  blkleft = 0;
+}
+
+int DataFile::LoadIndex( const string& idxfile )
+{
+  // Read event index. The index must match the current size of the data file.
+
+  struct stat st{};
+  if( stat(filename.c_str(), &st) != 0 ) {
+    cerr << "Cannot stat file " << filename << ": " << strerror(errno) << endl;
+    return 2;
+  }
+  const string& name = idxfile.empty() ? EventIndex::DefaultName(filename) : idxfile;
+  auto idx = make_shared<EventIndex>();
+  if( int status = idx->Read( name, st.st_size ); status != 0 )
+    return status;
+  index = std::move(idx);
+  return 0;
+}
+
+int DataFile::SeekEvent( size_t evnum )
+{
+  if( int status; !IsOpen() && (status = Open()) != 0 )
+    return status;
+  if( evnum == 0 )
+    evnum = 1;
+
+  if( int status = ScanBlocks(); status != 1 )
+    return (status == 0) ? SeekBlocked(evnum) : status;
+
+  if( HasIndex() ) {
+    if( evnum > index->GetNevents()+1 )
+      return -1;
+    uint64_t offset = (evnum <= index->GetNevents())
+                      ? index->GetEntry(evnum).offset : index->GetFileSize();
+    if( SetPosition(offset) != 0 ) {
+      cerr << "Error seeking to event " << evnum << " in file "
+           << filename << endl;
+      return 2;
+    }
+    format = 1;
+    return 0;
+  }
+
+  // No index. Skip events from the beginning of the file.
+  if( IsMapped() )
+    mappos = mapadvised = 0;
+  else if( prefetch ) {
+    if( prefetch->Seek(0) != 0 ) {
+      cerr << "Cannot rewind file " << filename << endl;
+      return 2;
+    }
+  } else
+    rewind(filep);
+  ResetFormat();
+  for( size_t i = 1; i < evnum; ++i ) {
+    if( int status = ReadEvent(); status != 0 )
+      return status;
+  }
+  return 0;
+}
+
+int DataFile::SetPosition( uint64_t offset )
+{
+  // Position the file at byte 'offset'
+
+  if( IsMapped() ) {
+    if( offset > mapsize )
+      return 2;
+    size_t pagesize = sysconf(_SC_PAGESIZE);
+    mappos = offset;
+    mapadvised = mappos - (mappos % pagesize);
+  } else if( prefetch ) {
+    if( prefetch->Seek(offset) != 0 )
+      return 2;
+  } else if( fseeko( filep, off_t(offset), SEEK_SET ) != 0 )
+    return 2;
+  return 0;
+}
+
+int DataFile::ScanBlocks()
+{
+  // Build the table of blocks from the block headers. Only the headers are
+  // read. Returns 0 for blocked files, 1 if the file is not blocked or
+  // cannot be positioned (compressed data, pipes), > 1 on error.
+
+  if( scanstat >= 0 )
+    return scanstat;
+  scanstat = 1;
+  if( prefetch && prefetch->GetCompression() != ReadAhead::kNone )
+    return scanstat;
+  FILE* fp = nullptr;
+  if( !IsMapped() && !(fp = fopen( filename.c_str(), "r" )) )
+    return scanstat;
+  auto read_at = [&]( uint64_t pos, void* dest, size_t len ) -> bool {
+    if( !fp ) {
+      if( pos > mapsize || mapsize - pos < len )
+        return false;
+      memcpy( dest, mapbase + pos, len );
+      return true;
+    }
+    return fseeko( fp, off_t(pos), SEEK_SET ) == 0 &&
+           fread( dest, 1, len, fp ) == len;
+  };
+
+  RawFileHeader fhdr{};
+  if( read_at( 0, &fhdr, sizeof(fhdr) ) &&
+      memcmp( fhdr.magic, RAWFILE_MAGIC, sizeof(RAWFILE_MAGIC) ) == 0 &&
+      (scanstat = CheckFileHeader(fhdr, filename)) == 0 ) {
+    uint64_t pos = fhdr.header_size, first = 1;
+    RawBlockHeader bhdr{};
+    while( read_at( pos, &bhdr, sizeof(bhdr) ) ) {
+      if( bhdr.magic != RAWBLOCK_MAGIC ) {
+        cerr << "Bad block header at offset " << pos << " in file "
+             << filename << endl;
+        scanstat = 5;
+        break;
+      }
+      blocks.push_back( {pos, first, bhdr.nevents, bhdr.length} );
+      first += bhdr.nevents;
+      pos += sizeof(bhdr) + bhdr.length;
+    }
+    blocks_end = pos;
+  }
+  if( fp )
+    fclose(fp);
+  if( scanstat != 0 )
+    blocks.clear();
+  return scanstat;
+}
+
+int DataFile::SeekBlocked( size_t evnum )
+{
+  // Position a blocked file at event 'evnum' using the block table
+
+  // The block holding the event. One may seek to one past the last event.
+  auto it = upper_bound( blocks.begin(), blocks.end(), evnum,
+                         []( size_t n, const BlockInfo& b ) { return n < b.first; } );
+  uint64_t offset = blocks_end;
+  size_t nskip = 0;
+  if( it == blocks.begin() ) {
+    if( evnum > 1 )
+      return -1;
+  } else if( --it; evnum < it->first + it->nevents ) {
+    offset = it->offset;
+    nskip = evnum - it->first;
+  } else if( evnum > it->first + it->nevents )
+    return -1;
+
+  if( SetPosition(offset) != 0 ) {
+    cerr << "Error seeking to event " << evnum << " in file "
+         << filename << endl;
+    return 2;
+  }
+  ResetFormat();
+  format = 2;
+  if( nskip == 0 )
+    return 0;
+
+  // Skip the preceding events of the block without copying them
+  if( int status = ReadBlock(); status != 0 )
+    return (status == -1) ? 4 : status;
+  const size_t wordsize = sizeof(evbuf_t);
+  for( ; nskip > 0; --nskip, --blkleft ) {
+    evbuf_t evsize = 0;
+    if( blkleft > 0 && size_t(blkend - blkptr) >= wordsize )
+      memcpy( &evsize, blkptr, wordsize );
+    if( evsize < wordsize || evsize > size_t(blkend - blkptr) ) {
+      cerr << "Error reading event data from file " << filename << endl;
+      return 4;
+    }
+    blkptr += evsize;
+  }
   return 0;
 }
 
@@ -51,30 +345,246 @@ int DataFile::ReadEvent()
   if( int status; !IsOpen() && (status = Open()) != 0 )
     return status;
 
-  clearerr(filep);
+  auto start = chrono::steady_clock::now();
+  int status;
+  if( IsMapped() )
+    status = ReadEventMapped();
+  else
+    status = ReadEventBuffered();
+  iostats.stall += chrono::steady_clock::now() - start;
+  if( status == 0 )
+    iostats.bytes += GetEvSize();
 
-  const size_t wordsize = sizeof(buffer[0]);
-  evbuf_t* bufptr = buffer.get();
+  return status;
+}
+
+int DataFile::ReadRaw( void* dest, size_t len )
+{
+  // Read 'len' bytes from the file or from the blocks read ahead by the
+  // background thread. Returns 0 on success, -1 if at end of file, and
+  // 2 if the file ends after a partial read or on error.
+
+  size_t n = 0;
+  int status = 0;
+  if( prefetch )
+    n = prefetch->Read( dest, len, status );
+  else {
+    n = fread( dest, 1, len, filep );
+    if( n != len && feof(filep) )
+      status = -1;
+  }
+  if( n == len )
+    return 0;
+  return (n == 0 && status == -1) ? -1 : 2;
+}
+
+int DataFile::ReadEventBuffered()
+{
+  // Read the next event into the private buffer (kStdio, kPrefetch)
+
+  if( filep )
+    clearerr(filep);
+  if( format == 2 )
+    return ReadEventBlocked();
+
+  const size_t wordsize = sizeof(evbuf_t);
 
   // Read header
-  if( fread( bufptr, 1, wordsize, filep ) != wordsize ) {
-    if( feof(filep) )
+  evbuf_t evsize = 0;
+  if( int status = ReadRaw( &evsize, wordsize ); status != 0 ) {
+    if( status == -1 )
       return -1;
     cerr << "Error reading event header from file " << filename << endl;
     return 2;
   }
-  evbuf_t evsize = buffer[0];
+  if( format == 0 ) {
+    // The first word tells blocked files from plain sequences of events
+    format = 1;
+    if( evsize == RAWFILE_MAGIC_WORD ) {
+      RawFileHeader hdr{};
+      memcpy( &hdr, &evsize, wordsize );
+      if( ReadRaw( reinterpret_cast<char*>(&hdr) + wordsize,
+                   sizeof(hdr) - wordsize ) != 0 ||
+          memcmp( hdr.magic, RAWFILE_MAGIC, sizeof(RAWFILE_MAGIC) ) != 0 ) {
+        cerr << "Error reading file header from file " << filename << endl;
+        return 2;
+      }
+      if( int status = CheckFileHeader(hdr, filename); status != 0 )
+        return status;
+      // Skip any extension of the header
+      blockbuf.resize( hdr.header_size - sizeof(hdr) );
+      if( !blockbuf.empty() && ReadRaw( blockbuf.data(), blockbuf.size() ) != 0 ) {
+        cerr << "Error reading file header from file " << filename << endl;
+        return 2;
+      }
+      format = 2;
+      return ReadEventBlocked();
+    }
+  }
   if( evsize > MAX_EVTSIZE*wordsize ) {
     cerr << "Event too large, size = " << evsize << endl;
     return 3;
   }
+  if( evsize < wordsize ) {
+    cerr << "Error reading event data from file " << filename << endl;
+    return 4;
+  }
+  BufferPool::Reserve( buffer, (evsize + wordsize - 1)/wordsize );
+  evbuf_t* bufptr = buffer.get();
+  bufptr[0] = evsize;
+  evptr = bufptr;
+
+  // Read data. EOF should never occur in the midst of the data.
+  if( ReadRaw( bufptr+1, evsize-wordsize ) != 0 ) {
+    cerr << "Error reading event data from file " << filename << endl;
+    return 4;
+  }
+
+  return 0;
+}
+
+int DataFile::ReadEventMapped()
+{
+  // Advance to the next event in the mapped file. No data are copied.
+
+  const size_t wordsize = sizeof(evbuf_t);
+
+  if( format == 0 ) {
+    format = 1;
+    RawFileHeader hdr{};
+    if( mapsize >= sizeof(hdr) ) {
+      memcpy( &hdr, mapbase, sizeof(hdr) );
+      if( memcmp( hdr.magic, RAWFILE_MAGIC, sizeof(RAWFILE_MAGIC) ) == 0 ) {
+        if( int status = CheckFileHeader(hdr, filename); status != 0 )
+          return status;
+        format = 2;
+        mappos = min<size_t>( hdr.header_size, mapsize );
+      }
+    }
+  }
+  if( format == 2 )
+    return ReadEventBlocked();
 
-  // Read data
-  if( fread( bufptr+1, 1, evsize-wordsize, filep ) != evsize-wordsize ) {
-    // EOF should never occur in the midst of the data
+  if( mappos == mapsize )
+    return -1;
+  if( mapsize - mappos < wordsize ) {
+    cerr << "Error reading event header from file " << filename << endl;
+    return 2;
+  }
+  const auto* ptr = reinterpret_cast<const evbuf_t*>(mapbase + mappos);
+  evbuf_t evsize = ptr[0];
+  if( evsize > MAX_EVTSIZE*wordsize ) {
+    cerr << "Event too large, size = " << evsize << endl;
+    return 3;
+  }
+  if( evsize < wordsize || evsize > mapsize - mappos ) {
     cerr << "Error reading event data from file " << filename << endl;
     return 4;
   }
+  evptr = ptr;
+  mappos += evsize;
+  AdviseMapped();
+
+  return 0;
+}
+
+void DataFile::AdviseMapped()
+{
+  // Keep the kernel reading ahead of us. Request the next window once
+  // we are halfway through the current one.
+
+  if( mapadvised < mapsize && mappos + MMAP_WILLNEED/2 >= mapadvised ) {
+    size_t len = min(MMAP_WILLNEED, mapsize - mapadvised);
+    madvise( const_cast<char*>(mapbase + mapadvised), len, MADV_WILLNEED );
+    mapadvised += len;
+  }
+}
+
+int DataFile::ReadBlock()
+{
+  // Read the next block of a blocked file and verify its checksum.
+  // In kMmap mode, the block is used in place.
+
+  RawBlockHeader hdr{};
+  const char* data = nullptr;
+  if( IsMapped() ) {
+    if( mappos == mapsize )
+      return -1;
+    if( mapsize - mappos < sizeof(hdr) ) {
+      cerr << "Error reading block header from file " << filename << endl;
+      return 2;
+    }
+    memcpy( &hdr, mapbase + mappos, sizeof(hdr) );
+    if( hdr.magic == RAWBLOCK_MAGIC &&
+        hdr.length > mapsize - mappos - sizeof(hdr) ) {
+      cerr << "Error reading block data from file " << filename << endl;
+      return 4;
+    }
+    data = mapbase + mappos + sizeof(hdr);
+  } else if( int status = ReadRaw( &hdr, sizeof(hdr) ); status != 0 ) {
+    if( status == -1 )
+      return -1;
+    cerr << "Error reading block header from file " << filename << endl;
+    return 2;
+  }
+  if( hdr.magic != RAWBLOCK_MAGIC ) {
+    cerr << "Bad block header in file " << filename << endl;
+    return 5;
+  }
+  if( IsMapped() ) {
+    mappos += sizeof(hdr) + hdr.length;
+    AdviseMapped();
+  } else {
+    blockbuf.resize(hdr.length);
+    if( ReadRaw( blockbuf.data(), hdr.length ) != 0 ) {
+      cerr << "Error reading block data from file " << filename << endl;
+      return 4;
+    }
+    data = blockbuf.data();
+  }
+  if( Crc32c( data, hdr.length ) != hdr.crc ) {
+    cerr << "Checksum error in block starting at event " << hdr.first_event
+         << " in file " << filename << endl;
+    return 6;
+  }
+  blkptr = data;
+  blkend = data + hdr.length;
+  blkleft = hdr.nevents;
+  return 0;
+}
+
+int DataFile::ReadEventBlocked()
+{
+  // Get the next event from the current block, reading blocks as needed
 
+  const size_t wordsize = sizeof(evbuf_t);
+
+  while( blkleft == 0 ) {
+    if( int status = ReadBlock(); status != 0 )
+      return status;
+  }
+  evbuf_t evsize = 0;
+  if( size_t(blkend - blkptr) < wordsize ) {
+    cerr << "Error reading event header from file " << filename << endl;
+    return 2;
+  }
+  memcpy( &evsize, blkptr, wordsize );
+  if( evsize > MAX_EVTSIZE*wordsize ) {
+    cerr << "Event too large, size = " << evsize << endl;
+    return 3;
+  }
+  if( evsize < wordsize || evsize > size_t(blkend - blkptr) ) {
+    cerr << "Error reading event data from file " << filename << endl;
+    return 4;
+  }
+  if( IsMapped() ) {
+    evptr = reinterpret_cast<const evbuf_t*>(blkptr);
+  } else {
+    BufferPool::Reserve( buffer, (evsize + wordsize - 1)/wordsize );
+    memcpy( buffer.get(), blkptr, evsize );
+    evptr = buffer.get();
+  }
+  blkptr += evsize;
+  --blkleft;
   return 0;
 }
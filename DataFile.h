@@ -4,35 +4,146 @@
 #ifndef PPODD_DATAFILE
 #define PPODD_DATAFILE
 
+#include "BufferPool.h"
+#include "EventIndex.h"
+#include "ReadAhead.h"
+#include "rawdata.h"
+#include <chrono>
 #include <cstdint>
 #include <cstdio>
 #include <string>
 #include <memory>
+#include <vector>
 
-using evbuf_t = uint32_t;
-using evbuf_ptr_t = std::unique_ptr<evbuf_t[]>;
-static constexpr size_t MAX_EVTSIZE = 4*1024*1024;
+// Event buffers come from the BufferPool, sized to the events they hold
+using evbuf_ptr_t = BufferPool::Buffer;
+static constexpr size_t MAX_EVTSIZE = size_t(1) << BufferPool::MAX_CLASS; // words
+
+// Input statistics
+struct IOStats {
+  uint64_t bytes{0};   // Event data read
+  std::chrono::duration<double, std::milli> stall{};  // Time spent in ReadEvent
+  IOStats& operator+=( const IOStats& rhs ) {
+    bytes += rhs.bytes; stall += rhs.stall; return *this;
+  }
+};
 
 class DataFile {
 public:
-  explicit DataFile( std::string filename = std::string() );
+  // Methods for accessing the file contents
+  enum EReadMode {
+    kStdio,  // Read each event into a private buffer with fread
+    kMmap,   // Map the entire file into memory. Events are read in place
+    kPrefetch // Read large blocks in a background thread (see ReadAhead).
+              // Events are copied into a private buffer as with kStdio
+  };
+  // gzip- or zstd-compressed files are recognized and always read as with
+  // kPrefetch, with decompression in the read-ahead stage.
+  // Both plain (version 1) and blocked (version 2) files are read, see
+  // rawdata.h. The checksum of each block is verified when the block is
+  // reached. Blocks are read whole; except in kMmap mode, their events are
+  // then copied into the private buffer one by one.
+
+  explicit DataFile( std::string filename = std::string(),
+                     EReadMode mode = kStdio );
   ~DataFile();
 
-  bool      IsOpen() { return (filep != nullptr); }
+  bool      IsOpen()   const {
+    return (filep != nullptr || mapfd >= 0 || (prefetch && prefetch->IsOpen()));
+  }
+  bool      IsMapped() const { return (mapfd >= 0); }
   int       Open( const std::string& filename = std::string() );
   int       ReadEvent();
   int       Close();
+  void      SetReadMode( EReadMode mode );
+  // Block size for kPrefetch mode. Takes effect at the next Open().
+  void      SetBlockSize( size_t bytes ) { blocksize = bytes; }
+  // Number of decompression threads for compressed files (0 = default).
+  // Takes effect at the next Open().
+  void      SetNThreads( unsigned int n ) { nthreads = n; }
 
-  [[nodiscard]] evbuf_t*  GetEvBufPtr() const { return buffer.get(); }
+  // Load the event index for this file. If 'idxfile' is empty, use the
+  // default sidecar name. Returns 0 on success, 1 if no index file is found,
+  // 2 if the index is invalid or does not match the data file.
+  int       LoadIndex( const std::string& idxfile = std::string() );
+  // Use an index already in memory, possibly shared with other readers
+  // of the same file
+  void      SetIndex( std::shared_ptr<const EventIndex> idx ) { index = std::move(idx); }
+  [[nodiscard]] bool HasIndex() const { return index && !index->IsEmpty(); }
+  [[nodiscard]] const std::shared_ptr<const EventIndex>& GetIndex() const { return index; }
+
+  // Position the file such that the next ReadEvent() returns event number
+  // 'evnum' (counting from 1). With an index, this takes constant time,
+  // otherwise all events before 'evnum' are read and discarded. Blocked
+  // files are positioned via their block headers; only the events
+  // preceding 'evnum' in its block are read.
+  // Returns 0 on success, -1 if the file has fewer than evnum-1 events,
+  // and > 0 on error.
+  int       SeekEvent( size_t evnum );
+
+  // Current event. In kMmap mode, this points into the file mapping and
+  // remains valid until the file is closed.
+  [[nodiscard]] const evbuf_t* GetEvBufPtr() const { return evptr; }
+  // Private event buffer. Not used in kMmap mode. Callers may swap
+  // this buffer with one of their own to take ownership of the event data.
+  // The buffer is enlarged as necessary and may be empty before reading.
   [[nodiscard]] evbuf_ptr_t& GetEvBuffer()    { return buffer; }
-  [[nodiscard]] evbuf_t   GetEvSize()   const { return buffer[0]; }
+  [[nodiscard]] evbuf_t   GetEvSize()   const { return evptr[0]; }
   [[nodiscard]] size_t    GetEvWords()  const { return GetEvSize()/sizeof(evbuf_t); }
 
+  // Amount of data read and time spent waiting for it since Open()
+  [[nodiscard]] const IOStats& GetIOStats() const { return iostats; }
+
 private:
 
   std::string filename;
+  EReadMode   mode;
   FILE*       filep;
-  evbuf_ptr_t buffer;   // Buffer for current event
+  evbuf_ptr_t buffer;   // Buffer for current event (kStdio, kPrefetch)
+  const evbuf_t* evptr; // Start of current event
+  std::shared_ptr<const EventIndex> index; // Event offsets, if loaded
+
+  // File mapping (kMmap)
+  int         mapfd;
+  const char* mapbase;
+  size_t      mapsize;
+  size_t      mappos;   // Offset of next event in the mapping
+  size_t      mapadvised; // End of region for which read-ahead was requested
+
+  // Background block reader (kPrefetch)
+  std::unique_ptr<ReadAhead> prefetch;
+  size_t      blocksize;
+  unsigned int nthreads;
+
+  // Blocked files
+  struct BlockInfo {
+    uint64_t offset;     // Offset of the block header in the file
+    uint64_t first;      // Number of the first event in the block
+    uint32_t nevents;
+    uint32_t length;     // Length of the event data
+  };
+  int         format;     // File format version, 0 = not yet determined
+  std::vector<char> blockbuf; // Current block (kStdio, kPrefetch)
+  const char* blkptr;     // Next event in current block
+  const char* blkend;     // End of current block
+  size_t      blkleft;    // Number of events remaining in current block
+  std::vector<BlockInfo> blocks; // Block table, for seeking
+  uint64_t    blocks_end; // End of the last block
+  int         scanstat;   // Result of ScanBlocks(), -1 = not yet scanned
+
+  IOStats     iostats;
+
+  int       OpenMapped();
+  int       ReadRaw( void* dest, size_t len );
+  int       ReadEventBuffered();
+  int       ReadEventMapped();
+  int       ReadEventBlocked();
+  int       ReadBlock();
+  int       ScanBlocks();
+  int       SeekBlocked( size_t evnum );
+  int       SetPosition( uint64_t offset );
+  void      AdviseMapped();
+  void      ResetFormat();
 };
 
 #endif
@@ -76,6 +76,7 @@ void Database::Clear()
   m_items.clear();
   m_items.shrink_to_fit();
   m_is_ready = false;
+  ++m_version;
 }
 
 std::optional<double> Database::Get( const string& key, const string& module,
@@ -104,6 +105,7 @@ std::optional<double> Database::Erase( const string& key, const string& module )
   if( it != m_items.end() ) {
     ret = it->value;
     m_items.erase(it);
+    ++m_version;
   }
   return ret;
 }
@@ -120,6 +122,7 @@ bool Database::Set( const string& key, const string& module, double val )
   } else {
     it->value = val;
   }
+  ++m_version;
   return ret;
 }
 
@@ -135,6 +138,7 @@ bool Database::Set( Item& item )
   } else {
     swap(*it,item);
   }
+  ++m_version;
   return ret;
 }
 
@@ -4,6 +4,7 @@
 #ifndef PPODD_DATABASE_H
 #define PPODD_DATABASE_H
 
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <optional>
@@ -58,6 +59,8 @@ public:
 
   [[nodiscard]] bool   IsReady() const { return m_is_ready; }
   [[nodiscard]] size_t GetSize() const { return m_items.size(); }
+  // Incremented whenever the contents change
+  [[nodiscard]] uint64_t GetVersion() const { return m_version; }
   void Print( std::ostream& os = std::cout ) const;
 
 private:
@@ -79,6 +82,7 @@ private:
   std::vector<Item> m_items;
 
   bool m_is_ready{false};  // True if database successfully read
+  uint64_t m_version{0};   // Number of changes made
 
   static int ParseDBkey( const std::string& line, Item& item );
   void ParseDBline( const std::string& line );
@@ -1,18 +1,129 @@
 // Interface for reading a data file for parallelization test
 
 #include "Decoder.h"
+#include <algorithm>
 #include <cstring>  // for memset, memcpy
 
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define PPODD_UNPACK_AVX2
+#endif
+
 using namespace std;
 
+// Unpack kernels. Each converts n codes to offset + scale * code.
+
+static void unpack_generic( const unsigned char* src, size_t n, uint32_t nbits,
+                            double offset, double scale, double* dest )
+{
+  const size_t nbytes = PackedSize(n, nbits);
+  const uint64_t mask = (nbits < 64) ? (uint64_t(1) << nbits) - 1 : ~uint64_t(0);
+  size_t bitpos = 0;
+  for( size_t i = 0; i < n; ++i, bitpos += nbits ) {
+    // Load the 8 bytes holding this code. Codes are at most 32 bits,
+    // so they never span more than 5 bytes.
+    size_t byte = bitpos / 8;
+    uint64_t w = 0;
+    memcpy( &w, src + byte, min<size_t>(8, nbytes - byte) );
+    dest[i] = offset + scale * double((w >> (bitpos % 8)) & mask);
+  }
+}
+
+template<typename T>
+static void unpack_scalar( const unsigned char* src, size_t n,
+                           double offset, double scale, double* dest )
+{
+  for( size_t i = 0; i < n; ++i ) {
+    T code;
+    memcpy( &code, src + i*sizeof(T), sizeof(T) );
+    dest[i] = offset + scale * double(code);
+  }
+}
+
+#ifdef PPODD_UNPACK_AVX2
+__attribute__((target("avx2")))
+static void unpack16_avx2( const unsigned char* src, size_t n,
+                           double offset, double scale, double* dest )
+{
+  const __m256d voff = _mm256_set1_pd(offset);
+  const __m256d vscale = _mm256_set1_pd(scale);
+  size_t i = 0;
+  for( ; i + 8 <= n; i += 8 ) {
+    __m128i codes = _mm_loadu_si128( (const __m128i*)(src + 2*i) );
+    __m256i wide = _mm256_cvtepu16_epi32(codes);
+    __m256d lo = _mm256_cvtepi32_pd( _mm256_castsi256_si128(wide) );
+    __m256d hi = _mm256_cvtepi32_pd( _mm256_extracti128_si256(wide, 1) );
+    _mm256_storeu_pd( dest + i,     _mm256_add_pd(voff, _mm256_mul_pd(lo, vscale)) );
+    _mm256_storeu_pd( dest + i + 4, _mm256_add_pd(voff, _mm256_mul_pd(hi, vscale)) );
+  }
+  unpack_scalar<uint16_t>( src + 2*i, n - i, offset, scale, dest + i );
+}
+
+__attribute__((target("avx2")))
+static void unpack8_avx2( const unsigned char* src, size_t n,
+                          double offset, double scale, double* dest )
+{
+  const __m256d voff = _mm256_set1_pd(offset);
+  const __m256d vscale = _mm256_set1_pd(scale);
+  size_t i = 0;
+  for( ; i + 8 <= n; i += 8 ) {
+    __m128i codes = _mm_loadl_epi64( (const __m128i*)(src + i) );
+    __m256i wide = _mm256_cvtepu8_epi32(codes);
+    __m256d lo = _mm256_cvtepi32_pd( _mm256_castsi256_si128(wide) );
+    __m256d hi = _mm256_cvtepi32_pd( _mm256_extracti128_si256(wide, 1) );
+    _mm256_storeu_pd( dest + i,     _mm256_add_pd(voff, _mm256_mul_pd(lo, vscale)) );
+    _mm256_storeu_pd( dest + i + 4, _mm256_add_pd(voff, _mm256_mul_pd(hi, vscale)) );
+  }
+  unpack_scalar<uint8_t>( src + i, n - i, offset, scale, dest + i );
+}
+
+static const bool have_avx2 = __builtin_cpu_supports("avx2");
+#endif
+
+void Decoder::Unpack( const unsigned char* src, size_t n, uint32_t nbits,
+                      double offset, double scale, double* dest )
+{
+#ifdef PPODD_UNPACK_AVX2
+  if( have_avx2 ) {
+    if( nbits == 16 )
+      return unpack16_avx2( src, n, offset, scale, dest );
+    if( nbits == 8 )
+      return unpack8_avx2( src, n, offset, scale, dest );
+  }
+#endif
+  if( nbits == 16 )
+    return unpack_scalar<uint16_t>( src, n, offset, scale, dest );
+  if( nbits == 8 )
+    return unpack_scalar<uint8_t>( src, n, offset, scale, dest );
+  unpack_generic( src, n, nbits, offset, scale, dest );
+}
+
 Decoder::Decoder() = default;
 
 void Decoder::Clear()
 {
-  memset( event.module, 0, sizeof(event.module) );
+  // Reset the modules of the previous event only
+
+  for( auto i : loaded )
+    modules[i] = {};
+  loaded.clear();
+  unpacked.clear();
 }
 
-int Decoder::Load( evbuf_t* evbuffer )
+void Decoder::SetModules( const vector<int>& mods )
+{
+  // An empty 'wanted' means all modules, so always keep one element
+  wanted.assign(1, false);
+  for( auto m : mods ) {
+    if( m < 0 )
+      continue;
+    if( size_t(m) >= wanted.size() )
+      wanted.resize(m+1);
+    wanted[m] = true;
+  }
+}
+
+int Decoder::Load( const evbuf_t* evbuffer )
 {
   int status = Preload( evbuffer );
   if( status )
@@ -20,34 +131,75 @@ int Decoder::Load( evbuf_t* evbuffer )
 
   Clear();
 
-  char* evtp = ((char*)evbuffer)+sizeof(event.header);
-  auto ndet = event.header.event_info & 0xFFFFU;
+  const char* evtp = ((const char*)evbuffer)+sizeof(header);
+  const char* evend = ((const char*)evbuffer)+header.event_length;
+  bool have_packed = false;
+  auto ndet = header.event_info & EVINFO_NMODULES;
   for( decltype(ndet) i = 0; i < ndet; ++i ) {
-    auto* m = (ModuleData*)evtp;
-    if( !m )
+    ModuleHeader mh;
+    if( evend - evtp < ptrdiff_t(sizeof(mh)) )
+      return 3;
+    memcpy( &mh, evtp, sizeof(mh) );
+    if( mh.module_length < sizeof(mh) || mh.module_length > size_t(evend - evtp) )
       return 3;
-    int imod = m->header.module_number;
+    int imod = mh.module_number & MODNUM_NUMBER;
     if( imod < 1 )
       return 4;
-    event.module[imod-1] = m;
-    evtp += m->header.module_length;
+    if( !wanted.empty() && (size_t(imod) > wanted.size() || !wanted[imod-1]) ) {
+      evtp += mh.module_length;
+      continue;
+    }
+    if( size_t(imod) > modules.size() )
+      modules.resize(imod);
+    auto& mod = modules[imod-1];
+    if( mod.ndata == 0 && mod.data == nullptr )
+      loaded.push_back(imod-1);
+    mod.ndata = mh.module_ndata;
+    if( mh.module_number & MODNUM_PACKED ) {
+      // Expand packed integers into 'unpacked'. Its data may move as it
+      // grows, so the pointers are set once all modules are loaded.
+      PackedHeader ph;
+      if( mh.module_length < sizeof(mh) + sizeof(ph) )
+        return 5;
+      memcpy( &ph, evtp + sizeof(mh), sizeof(ph) );
+      if( ph.nbits < 1 || ph.nbits > 32 ||
+          mh.module_length < sizeof(mh) + sizeof(ph) + PackedSize(mod.ndata, ph.nbits) )
+        return 5;
+      mod.data = nullptr;
+      mod.offset = unpacked.size();
+      unpacked.resize( unpacked.size() + mod.ndata );
+      Unpack( (const unsigned char*)evtp + sizeof(mh) + sizeof(ph),
+              mod.ndata, ph.nbits, ph.offset, ph.scale, unpacked.data() + mod.offset );
+      have_packed = true;
+    } else {
+      if( mh.module_length < sizeof(mh) + mod.ndata * sizeof(EvDat_t) )
+        return 5;
+      mod.data = (const double*)(evtp + sizeof(mh));
+    }
+    evtp += mh.module_length;
+  }
+  if( have_packed ) {
+    for( auto i : loaded ) {
+      if( !modules[i].data )
+        modules[i].data = unpacked.data() + modules[i].offset;
+    }
   }
   return 0;
 }
 
-int Decoder::Preload( evbuf_t* evbuffer )
+int Decoder::Preload( const evbuf_t* evbuffer )
 {
   if( !evbuffer )
     return 1;
   if( evbuffer[0] < 8 )
     return 2;
 
-  memcpy( &event.header, evbuffer, sizeof(event.header) );
+  memcpy( &header, evbuffer, sizeof(header) );
 
   return 0;
 }
 
 bool Decoder::IsSyncEvent() const
 {
-  return ((event.header.event_info & 0x10000U) != 0);
+  return ((header.event_info & EVINFO_SYNC) != 0);
 }
@@ -12,43 +12,66 @@ class Decoder {
 public:
   Decoder();
 
-  int Load( evbuf_t* evbuffer );
-  int Preload( evbuf_t* evbuffer );
+  int Load( const evbuf_t* evbuffer );
+  int Preload( const evbuf_t* evbuffer );
+  // Forget the current event, leaving an event without any modules
+  void Clear();
+
+  // Decode only the modules with the given indices (module number - 1).
+  // The data of all other modules are skipped. By default, all modules
+  // are decoded.
+  void SetModules( const std::vector<int>& mods );
 
-  [[nodiscard]] uint32_t GetEvSize()  const { return event.header.event_length; }
+  [[nodiscard]] uint32_t GetEvSize()  const { return header.event_length; }
   [[nodiscard]] uint32_t GetNdata( int m ) const;
   [[nodiscard]] double   GetData( uint32_t m, uint32_t i ) const;
-  [[nodiscard]] double*  GetDataBuf( uint32_t m ) const;
+  [[nodiscard]] const double* GetDataBuf( uint32_t m ) const;
   [[nodiscard]] bool     IsSyncEvent() const;
 
+  // Expand 'n' packed integers of 'nbits' bits at 'src' into
+  // offset + scale * code. Vectorized for 8- and 16-bit codes.
+  static void Unpack( const unsigned char* src, size_t n, uint32_t nbits,
+                      double offset, double scale, double* dest );
+
 private:
-  Event event;
+  // Data of one module in the current event
+  struct Module {
+    const double* data;  // Values, in the event buffer or in 'unpacked'
+    uint32_t ndata;      // Number of values
+    uint32_t offset;     // Position in 'unpacked' while loading packed data
+  };
 
-  void Clear();
+  EventHeader header;
+  // Modules of the current event, indexed by module number - 1. Module
+  // numbers are at most MODNUM_NUMBER, so a direct table stays small.
+  std::vector<Module>   modules;
+  std::vector<uint32_t> loaded;    // Indices of the modules set in 'modules'
+  std::vector<double>   unpacked;  // Expanded data of packed modules
+  std::vector<bool>     wanted;    // Modules to decode, empty = all
 };
 
 
 inline
 uint32_t Decoder::GetNdata( int m ) const
 {
-  if( event.module[m] == nullptr )
+  if( size_t(m) >= modules.size() )
     return 0;
 
-  return event.module[m]->header.module_ndata;
+  return modules[m].ndata;
 }
 
 inline
 double Decoder::GetData( uint32_t m, uint32_t i ) const
 {
-  assert( event.module[m] );
-  return event.module[m]->data[i];
+  assert( m < modules.size() && modules[m].data );
+  return modules[m].data[i];
 }
 
 inline
-double* Decoder::GetDataBuf( uint32_t m ) const
+const double* Decoder::GetDataBuf( uint32_t m ) const
 {
-  assert( event.module[m] );
-  return event.module[m]->data;
+  assert( m < modules.size() && modules[m].data );
+  return modules[m].data;
 }
 
 #endif
@@ -3,10 +3,17 @@
 #include "Detector.h"
 #include "Decoder.h"
 #include "Variable.h"
+#include "Database.h"
+#include "ResultCache.h"
 #include <iostream>
+#include <fstream>
+#include <sstream>
 #include <algorithm>
+#include <map>
+#include <boost/algorithm/string/trim.hpp>
 
 using namespace std;
+using namespace boost::algorithm;
 
 Detector::Detector( string _name, int _imod )
   : name(std::move(_name))
@@ -14,7 +21,9 @@ Detector::Detector( string _name, int _imod )
   , imod(_imod-1)
   , fVars(nullptr)
 {
-  if( imod<0 ) {
+  // Module number 0 means no raw data, e.g. for detectors that only
+  // combine the results of others
+  if( _imod<0 ) {
     cerr << "\"" << name << "\": "
 	 << "Warning: invalid module number = " << _imod << endl;
   }
@@ -23,7 +32,8 @@ Detector::Detector( string _name, int _imod )
 // Clear event-by-event data
 void Detector::Clear()
 {
-  data.clear();
+  data = {};
+  datacopy.clear();
 }
 
 // Initialize detector
@@ -33,6 +43,8 @@ int Detector::Init( bool shared )
   int ret = ReadDatabase(shared);
   if( !shared )
     DefineVariables( kDefine );
+  else if( use_cache )
+    cache = make_shared<ResultCache>();
   return ret;
 }
 
@@ -48,8 +60,10 @@ int Detector::Decode( Decoder& evdata )
     if( debug > 3 )
       cout << ", data = ";
 
-    double* pdata = evdata.GetDataBuf(imod);
-    data.assign( pdata, pdata+ndata );
+    const double* pdata = evdata.GetDataBuf(imod);
+    data = { pdata, ndata };
+    if( copy_data )
+      datacopy.assign( pdata, pdata+ndata );
 
     if( debug > 3 ) {
       for( decltype(ndata) i = 0; i < ndata; ++i ) {
@@ -65,6 +79,56 @@ int Detector::Decode( Decoder& evdata )
   return 0;
 }
 
+// Generic batch processing: analyze the events one by one
+int Detector::AnalyzeBatch( Span<Decoder> evdata, ResultRows results )
+{
+  int ret = 0;
+  for( size_t i = 0; i < evdata.size(); ++i ) {
+    Clear();
+    cur_row = results[i];
+    int status = Decode(evdata[i]);
+    uint64_t dbversion = 0;
+    if( status == 0 && cache ) {
+      GetCacheKey(cache_key);
+      dbversion = database.GetVersion();
+      if( cache->Find({ cache_key.data(), cache_key.size() }, dbversion,
+                      cache_values) ) {
+        for( size_t k = 0; k < outputs.size(); ++k )
+          memcpy(results[i] + outputs[k].offset, &cache_values[k], sizeof(double));
+        continue;
+      }
+    }
+    if( status == 0 )
+      status = Analyze();
+    if( status != 0 )
+      ret = status;
+    StoreResults(results[i]);
+    // Only successful results are reused
+    if( status == 0 && cache ) {
+      cache_values.resize(outputs.size());
+      for( size_t k = 0; k < outputs.size(); ++k )
+        cache_values[k] = *outputs[k].loc;
+      cache->Insert({ cache_key.data(), cache_key.size() }, dbversion,
+                    { cache_values.data(), cache_values.size() });
+    }
+  }
+  return ret;
+}
+
+void Detector::GetCacheKey( vector<double>& key ) const
+{
+  key.assign(data.begin(), data.end());
+  for( size_t j = 0; j < input_offsets.size(); ++j )
+    key.push_back(GetInput(j));
+}
+
+void Detector::SetInputOffset( size_t j, size_t offset )
+{
+  if( input_offsets.size() < inputs.size() )
+    input_offsets.resize(inputs.size());
+  input_offsets.at(j) = offset;
+}
+
 void Detector::Print() const
 {
   cout << "DET(" << type << "): " << name << endl;
@@ -101,22 +165,17 @@ int DefineVarsFromList( const std::vector<VarDef_t>& defs,
       varname += '.';
     }
     varname.append(def.name);
-    auto it = find_if( ALL(vars), [&varname](auto& var) {
-      return (var && var->GetName() == varname);
-    });
     if( remove ) {
-      if( it != vars.end() ) {
-	vars.erase(it);
+      if( vars.Remove(varname) )
 	++ndef;
-      }
     } else {
-      if( it != vars.end() ) {
+      if( vars.Find(varname) ) {
 	cerr << "Variable " << varname << " already exists, skipped" << endl;
       } else if( !def.loc ) {
 	cerr << "Invalid location pointer for variable " << varname
 	     << ", skipped " << endl;
       } else {
-	vars.push_back( make_unique<Variable>(varname, def.note, def.loc) );
+	vars.Add(varname, def.note, def.loc);
 	++ndef;
       }
     }
@@ -124,3 +183,98 @@ int DefineVarsFromList( const std::vector<VarDef_t>& defs,
 
   return ndef;
 }
+
+// Declared in Podd.h
+void PrintCacheStats( const detlst_t& dets )
+{
+  for( const auto& det : dets ) {
+    if( const auto& cache = det->GetCache() )
+      cache->Print(det->GetName());
+  }
+}
+
+// Registered detector types, by type name. A function-level static is
+// constructed before the first registration, whatever the order in which
+// the detector classes are initialized.
+static map<string, DetectorMaker>& DetectorTypes()
+{
+  static map<string, DetectorMaker> types;
+  return types;
+}
+
+bool RegisterDetectorType( const string& type, DetectorMaker maker )
+{
+  DetectorTypes()[type] = std::move(maker);
+  return true;
+}
+
+unique_ptr<Detector> MakeDetector( const string& type, const string& name,
+                                   int imod, const vector<string>& args )
+{
+  auto it = DetectorTypes().find(type);
+  if( it == DetectorTypes().end() )
+    return nullptr;
+  return it->second(name, imod, args);
+}
+
+// Detectors used without a detector list file
+static const char* const default_detectors =
+  "A detA 1\n"
+  "B detB 2\n"
+  "C detC 3\n"
+  "D detD 0 detA.mean detB.slope\n";
+
+static int ReadDetectorList( istream& is, const string& source, detlst_t& dets )
+{
+  int lineno = 0;
+  string line;
+  while( getline(is, line) ) {
+    ++lineno;
+    if( string::size_type pos = line.find('#'); pos != string::npos )
+      line.erase(pos);
+    trim(line);
+    if( line.empty() )
+      continue;
+    istringstream istr(line);
+    string type, name;
+    int imod = -1;
+    if( !(istr >> type >> name >> imod) || imod < 0 || imod > MODNUM_NUMBER ) {
+      cerr << "Bad detector definition in " << source << " line "
+           << lineno << ": " << line << endl;
+      return 1;
+    }
+    vector<string> args;
+    for( string arg; istr >> arg; )
+      args.push_back(std::move(arg));
+    if( any_of( ALL(dets), [&name]( const auto& det ) {
+          return det->GetName() == name; }) ) {
+      cerr << "Duplicate detector name " << name << " in " << source
+           << " line " << lineno << endl;
+      return 1;
+    }
+    auto det = MakeDetector(type, name, imod, args);
+    if( !det ) {
+      cerr << "Cannot create detector " << name << " of type " << type
+           << " in " << source << " line " << lineno
+           << ": unknown type or invalid arguments" << endl;
+      return 1;
+    }
+    dets.push_back(std::move(det));
+  }
+  return 0;
+}
+
+// Declared in Podd.h
+int MakeDetectors( const string& filename, detlst_t& dets )
+{
+  if( filename.empty() ) {
+    istringstream istr(default_detectors);
+    return ReadDetectorList(istr, "default detector list", dets);
+  }
+  ifstream ifs(filename);
+  if( !ifs ) {
+    cerr << "Error opening detector list file " << filename << endl;
+    return 1;
+  }
+  return ReadDetectorList(ifs, filename, dets);
+}
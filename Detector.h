@@ -4,11 +4,26 @@
 #define PPODD_DETECTOR
 
 #include "Podd.h"
+#include "Util.h"
+#include <cstring>
+#include <functional>
 #include <string>
 #include <vector>
 #include <memory>
 
 class Decoder;
+class ResultCache;
+
+// Analysis results of a batch of events. Row i holds the results of
+// event i: the record written to the output file, laid out as given by the
+// OutputSchema, followed by the inputs of detectors that are not output
+// (see Context::Init). Values are stored at byte offsets and are not
+// necessarily aligned.
+struct ResultRows {
+  char*   data;
+  size_t  stride;   // Row size (bytes)
+  [[nodiscard]] char* operator[]( size_t i ) const { return data + i*stride; }
+};
 
 class Detector {
 public:
@@ -22,17 +37,83 @@ public:
   virtual int  Analyze() = 0;
   virtual void Print() const;
 
+  // Decode and analyze all events in 'evdata' and store the output values
+  // of event i in results[i]. The default implementation runs Clear, Decode
+  // and Analyze for one event at a time. Returns 0 if all events were
+  // processed without error.
+  virtual int  AnalyzeBatch( Span<Decoder> evdata, ResultRows results );
+
+  // Store the value at 'loc', one of our variables, at byte 'offset' of
+  // the result rows
+  void AddOutput( size_t offset, const double* loc ) { outputs.push_back({offset, loc}); }
+
+  // Names of the variables of other detectors used by this detector. The
+  // Context runs their detectors first and sets the position of input j
+  // in the result rows with SetInputOffset(j, offset).
+  [[nodiscard]] const std::vector<std::string>& GetInputs() const { return inputs; }
+  void SetInputOffset( size_t j, size_t offset );
+
   void SetVarList( std::shared_ptr<varlst_t> lst ) { fVars = std::move(lst); }
 
+  // Result cache shared by all clones of this detector, if enabled
+  [[nodiscard]] const std::shared_ptr<ResultCache>& GetCache() const { return cache; }
+
   [[nodiscard]] const std::string& GetName() const { return name; }
   [[nodiscard]] const std::string& GetType() const { return type; }
+  // Index of the module read by this detector (module number - 1), or -1
+  // if the detector reads no raw data
+  [[nodiscard]] int GetModule() const { return imod; }
 
 protected:
   std::string name;    // Name
   std::string type;    // Type (for identifying subclass)
   int imod;            // Module number (for decoding)
 
-  std::vector<double> data; // Raw data
+  // Raw data of the current event. 'data' views the Decoder's buffers and
+  // is valid until the next event is loaded. Detectors that modify their
+  // input set 'copy_data' and work on the private copy 'datacopy'.
+  Span<const double>  data;
+  std::vector<double> datacopy;
+  bool                copy_data{false};
+
+  // Input variables (see GetInputs) and their positions in the result
+  // rows. 'cur_row' is the result row of the current event, set by
+  // AnalyzeBatch before Analyze. Overrides of AnalyzeBatch for detectors
+  // with inputs must set it, too.
+  std::vector<std::string> inputs;
+  std::vector<size_t>      input_offsets;
+  const char*              cur_row{nullptr};
+  [[nodiscard]] double GetInput( size_t j ) const {
+    double val;
+    memcpy(&val, cur_row + input_offsets[j], sizeof(val));
+    return val;
+  }
+
+  // Output variables of this detector and their positions in the result
+  // rows
+  struct Output {
+    size_t        offset;
+    const double* loc;
+  };
+  std::vector<Output> outputs;
+
+  // Copy the current values of the output variables into 'row'
+  void StoreResults( char* row ) const {
+    for( const auto& out : outputs )
+      memcpy(row + out.offset, out.loc, sizeof(double));
+  }
+
+  // Detectors whose results depend only on their input and the database
+  // may set 'use_cache' in ReadDatabase(true), usually from the database
+  // key "<name>.cache", to reuse the output values for repeated inputs.
+  // Init(true) then creates a cache for all clones. Off by default.
+  bool use_cache{false};
+  std::shared_ptr<ResultCache> cache;
+  std::vector<double> cache_key, cache_values;  // Scratch space
+
+  // Put the input that determines the results of the current event into
+  // 'key'. The default is the raw data followed by the input variables.
+  virtual void GetCacheKey( std::vector<double>& key ) const;
 
   // Pointer to list of all analysis variables. The list is held in the
   // Context that also holds this detector (see Context.h). Each detector
@@ -54,4 +135,20 @@ protected:
   virtual int ReadDatabase( bool shared );
 };
 
+// Creates a detector of one type with the given name and module number.
+// 'args' are any further arguments from the detector list, e.g. input
+// variables. Returns nullptr if the arguments are invalid.
+using DetectorMaker = std::function<std::unique_ptr<Detector>(
+  const std::string& name, int imod, const std::vector<std::string>& args )>;
+
+// Register 'maker' for detectors of type 'type' (see Detector::GetType).
+// Detector classes register themselves at program start. Returns true.
+bool RegisterDetectorType( const std::string& type, DetectorMaker maker );
+
+// Create a detector of the registered type 'type'. Returns nullptr if
+// the type is unknown or the arguments are invalid.
+std::unique_ptr<Detector> MakeDetector( const std::string& type,
+                                        const std::string& name, int imod,
+                                        const std::vector<std::string>& args = {} );
+
 #endif
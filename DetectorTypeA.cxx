@@ -3,10 +3,208 @@
 #include "Podd.h"
 #include "DetectorTypeA.h"
 #include "Decoder.h"
+#include <algorithm>
 #include <cmath>
+#include <cstdint>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define PPODD_STATS_SIMD
+#endif
 
 using namespace std;
 
+// Statistics kernels. The kernels process W lanes at once. Element (k,l)
+// of the input is stream[k*W+l]; lane l holds count[l] elements. This
+// covers both the values of one module, read contiguously, and a batch of
+// W modules, transposed so that each lane holds one module.
+//
+// To avoid one log() per value, the sum of log|x| is carried as a product
+// of mantissas (kept in [1,2)) and a sum of binary exponents.
+
+static constexpr size_t MAXLANES = 8;
+// Modules with fewer values are processed one per lane, longer ones are
+// spread over the lanes. Either way, the results for a module depend only
+// on its data, not on the events processed along with it.
+static constexpr size_t SIMD_MIN_DATA = 32;
+
+// Partial statistics of one lane
+struct LaneStats {
+  double  sum;
+  double  min;
+  double  max;
+  double  prod;    // Product of the mantissas of |x|
+  int64_t expsum;  // Sum of the binary exponents of |x|
+  bool    bad;     // Some |x| was zero, subnormal, inf or nan
+  [[nodiscard]] double logsum() const { return log(prod) + double(expsum) * M_LN2; }
+};
+
+// Initial extrema, as set by DetectorTypeA::Clear
+static constexpr double MIN_INIT = 1e38;
+
+#ifdef PPODD_STATS_SIMD
+static constexpr int64_t ABS_MASK  = 0x7FFFFFFFFFFFFFFF;
+static constexpr int64_t MANT_MASK = 0x000FFFFFFFFFFFFF;
+static constexpr int64_t ONE_BITS  = 0x3FF0000000000000;  // 1.0
+static constexpr int64_t EXP_BIAS  = 1023;
+static constexpr int64_t EXP_MAX   = 0x7FF;
+
+__attribute__((target("avx2")))
+static void stats_avx2( const double* stream, size_t nrow,
+                        const int64_t* count, LaneStats* out )
+{
+  constexpr size_t W = 4;
+  const __m256i vcount = _mm256_loadu_si256( (const __m256i*)count );
+  const __m256i absmask = _mm256_set1_epi64x(ABS_MASK);
+  const __m256i mantmask = _mm256_set1_epi64x(MANT_MASK);
+  const __m256i onebits = _mm256_set1_epi64x(ONE_BITS);
+  const __m256i bias = _mm256_set1_epi64x(EXP_BIAS);
+  const __m256i expmax = _mm256_set1_epi64x(EXP_MAX);
+  const __m256i zero = _mm256_setzero_si256();
+  __m256d sum = _mm256_setzero_pd();
+  __m256d vmin = _mm256_set1_pd(MIN_INIT);
+  __m256d vmax = _mm256_set1_pd(-MIN_INIT);
+  __m256d prod = _mm256_set1_pd(1.0);
+  __m256i esum = zero, bad = zero, k = zero;
+  for( size_t r = 0; r < nrow; ++r ) {
+    // Masked-off elements are not read and load as 0
+    __m256i valid = _mm256_cmpgt_epi64(vcount, k);
+    __m256d x = _mm256_maskload_pd(stream + W*r, valid);
+    __m256d m = _mm256_castsi256_pd(valid);
+    sum = _mm256_add_pd(sum, x);
+    // min(x,v) returns v unless x < v, like the scalar comparison
+    vmin = _mm256_blendv_pd(vmin, _mm256_min_pd(x, vmin), m);
+    vmax = _mm256_blendv_pd(vmax, _mm256_max_pd(x, vmax), m);
+    // Split |x| into exponent and mantissa. Masked-off lanes use 1.0.
+    __m256i bits = _mm256_and_si256(_mm256_castpd_si256(x), absmask);
+    bits = _mm256_blendv_epi8(onebits, bits, valid);
+    __m256i e = _mm256_srli_epi64(bits, 52);
+    bad = _mm256_or_si256(bad, _mm256_or_si256(_mm256_cmpeq_epi64(e, zero),
+                                               _mm256_cmpeq_epi64(e, expmax)));
+    esum = _mm256_add_epi64(esum, _mm256_sub_epi64(e, bias));
+    __m256d mant = _mm256_castsi256_pd(
+      _mm256_or_si256(_mm256_and_si256(bits, mantmask), onebits));
+    // Renormalize the product to [1,2)
+    __m256i pbits = _mm256_castpd_si256(_mm256_mul_pd(prod, mant));
+    esum = _mm256_add_epi64(esum, _mm256_sub_epi64(_mm256_srli_epi64(pbits, 52), bias));
+    prod = _mm256_castsi256_pd(
+      _mm256_or_si256(_mm256_and_si256(pbits, mantmask), onebits));
+    k = _mm256_add_epi64(k, _mm256_set1_epi64x(1));
+  }
+  alignas(32) double s[W], lo[W], hi[W], p[W];
+  alignas(32) int64_t es[W], b[W];
+  _mm256_store_pd(s, sum);
+  _mm256_store_pd(lo, vmin);
+  _mm256_store_pd(hi, vmax);
+  _mm256_store_pd(p, prod);
+  _mm256_store_si256((__m256i*)es, esum);
+  _mm256_store_si256((__m256i*)b, bad);
+  for( size_t l = 0; l < W; ++l )
+    out[l] = { s[l], lo[l], hi[l], p[l], es[l], b[l] != 0 };
+}
+
+__attribute__((target("avx512f")))
+static void stats_avx512( const double* stream, size_t nrow,
+                          const int64_t* count, LaneStats* out )
+{
+  constexpr size_t W = 8;
+  const __m512i vcount = _mm512_loadu_si512( count );
+  const __m512i absmask = _mm512_set1_epi64(ABS_MASK);
+  const __m512i mantmask = _mm512_set1_epi64(MANT_MASK);
+  const __m512i onebits = _mm512_set1_epi64(ONE_BITS);
+  const __m512i bias = _mm512_set1_epi64(EXP_BIAS);
+  const __m512i expmax = _mm512_set1_epi64(EXP_MAX);
+  const __m512i zero = _mm512_setzero_si512();
+  __m512d sum = _mm512_setzero_pd();
+  __m512d vmin = _mm512_set1_pd(MIN_INIT);
+  __m512d vmax = _mm512_set1_pd(-MIN_INIT);
+  __m512d prod = _mm512_set1_pd(1.0);
+  __m512i esum = zero, k = zero;
+  __mmask8 bad = 0;
+  for( size_t r = 0; r < nrow; ++r ) {
+    __mmask8 valid = _mm512_cmpgt_epi64_mask(vcount, k);
+    __m512d x = _mm512_maskz_loadu_pd(valid, stream + W*r);
+    sum = _mm512_add_pd(sum, x);
+    vmin = _mm512_mask_min_pd(vmin, valid, x, vmin);
+    vmax = _mm512_mask_max_pd(vmax, valid, x, vmax);
+    __m512i bits = _mm512_mask_and_epi64(onebits, valid,
+                                         _mm512_castpd_si512(x), absmask);
+    // (maskz_ form avoids a spurious uninitialized warning with GCC 12)
+    __m512i e = _mm512_maskz_srli_epi64(0xFF, bits, 52);
+    bad |= _mm512_cmpeq_epi64_mask(e, zero) | _mm512_cmpeq_epi64_mask(e, expmax);
+    esum = _mm512_add_epi64(esum, _mm512_sub_epi64(e, bias));
+    __m512d mant = _mm512_castsi512_pd(
+      _mm512_or_si512(_mm512_and_si512(bits, mantmask), onebits));
+    __m512i pbits = _mm512_castpd_si512(_mm512_mul_pd(prod, mant));
+    esum = _mm512_add_epi64(esum, _mm512_sub_epi64(_mm512_maskz_srli_epi64(0xFF, pbits, 52), bias));
+    prod = _mm512_castsi512_pd(
+      _mm512_or_si512(_mm512_and_si512(pbits, mantmask), onebits));
+    k = _mm512_add_epi64(k, _mm512_set1_epi64(1));
+  }
+  alignas(64) double s[W], lo[W], hi[W], p[W];
+  alignas(64) int64_t es[W];
+  _mm512_store_pd(s, sum);
+  _mm512_store_pd(lo, vmin);
+  _mm512_store_pd(hi, vmax);
+  _mm512_store_pd(p, prod);
+  _mm512_store_si512(es, esum);
+  for( size_t l = 0; l < W; ++l )
+    out[l] = { s[l], lo[l], hi[l], p[l], es[l], ((bad >> l) & 1) != 0 };
+}
+
+// Number of lanes of the best kernel supported by this CPU, 1 = none
+static const size_t simd_width =
+  __builtin_cpu_supports("avx512f") ? 8 : __builtin_cpu_supports("avx2") ? 4 : 1;
+
+static void stats_simd( const double* stream, size_t nrow,
+                        const int64_t* count, LaneStats* out )
+{
+  if( simd_width == 8 )
+    stats_avx512( stream, nrow, count, out );
+  else
+    stats_avx2( stream, nrow, count, out );
+}
+
+// Statistics of the n <= simd_width short modules 'x', one per lane.
+// Unused lanes have count 0. 'soa' is scratch space.
+static void stats_lanes( const Span<const double>* x, size_t n,
+                         vector<double>& soa, LaneStats* out )
+{
+  const size_t W = simd_width;
+  int64_t count[MAXLANES] = {};
+  size_t nrow = 0;
+  for( size_t l = 0; l < n; ++l ) {
+    count[l] = int64_t(x[l].size());
+    nrow = std::max(nrow, x[l].size());
+  }
+  // Transpose. Elements beyond each lane's count are never read.
+  soa.resize(nrow * W);
+  for( size_t l = 0; l < n; ++l ) {
+    for( size_t k = 0; k < x[l].size(); ++k )
+      soa[k*W + l] = x[l][k];
+  }
+  stats_simd( soa.data(), nrow, count, out );
+}
+#else
+static constexpr size_t simd_width = 1;
+#endif
+
+// Sum of log|x|, the reference for the kernels' mantissa/exponent sums
+static double logsum_scalar( Span<const double> x )
+{
+  double s = 0;
+  for( double xi : x )
+    s += log(fabs(xi));
+  return s;
+}
+
+static const bool registered = RegisterDetectorType("A",
+  []( const string& name, int imod, const vector<string>& args ) -> unique_ptr<Detector> {
+    if( !args.empty() )
+      return nullptr;
+    return make_unique<DetectorTypeA>(name, imod);
+  });
+
 DetectorTypeA::DetectorTypeA( const string& name, int imod )
   : Detector(name, imod)
 {
@@ -44,25 +242,109 @@ int DetectorTypeA::Decode( Decoder& evdata )
   return 0;
 }
 
+void DetectorTypeA::SetResults( double s, double lo, double hi, double logsum )
+{
+  sum = s;
+  min = lo;
+  max = hi;
+  mean = sum/nval;
+  geom = exp(logsum/nval);
+}
+
 int DetectorTypeA::Analyze()
 {
   // This detector type computes some basic statistics of the raw data
 
-  if( !data.empty() ) {
-    auto n = double(data.size());
-    for( double x : data ) {
-      sum += x;
-      if( x < min ) min = x;
-      if( x > max ) max = x;
-      geom += log(fabs(x));
+  if( data.empty() )
+    return 0;
+
+#ifdef PPODD_STATS_SIMD
+  if( const size_t W = simd_width; W > 1 && data.size() >= SIMD_MIN_DATA ) {
+    // Vectorize across the data: lane l gets values l, l+W, l+2W, ...
+    int64_t count[MAXLANES];
+    for( size_t l = 0; l < W; ++l )
+      count[l] = (data.size() - l + W - 1) / W;
+    LaneStats lanes[MAXLANES];
+    stats_simd( data.data(), count[0], count, lanes );
+    LaneStats t = lanes[0];
+    for( size_t l = 1; l < W; ++l ) {
+      const auto& ln = lanes[l];
+      t.sum += ln.sum;
+      if( ln.min < t.min ) t.min = ln.min;
+      if( ln.max > t.max ) t.max = ln.max;
+      t.prod *= ln.prod;
+      t.expsum += ln.expsum;
+      t.bad = t.bad || ln.bad;
     }
-    mean = sum/n;
-    geom = exp(geom/n);
+    SetResults( t.sum, t.min, t.max, t.bad ? logsum_scalar(data) : t.logsum() );
+    return 0;
+  }
+  if( simd_width > 1 ) {
+    // Same as in AnalyzeBatch, with the other lanes empty
+    LaneStats lanes[MAXLANES];
+    stats_lanes( &data, 1, soa, lanes );
+    const auto& ln = lanes[0];
+    SetResults( ln.sum, ln.min, ln.max, ln.bad ? logsum_scalar(data) : ln.logsum() );
+    return 0;
   }
+#endif
+  for( double x : data ) {
+    sum += x;
+    if( x < min ) min = x;
+    if( x > max ) max = x;
+  }
+  SetResults( sum, min, max, logsum_scalar(data) );
 
   return 0;
 }
 
+int DetectorTypeA::AnalyzeBatch( Span<Decoder> evdata, ResultRows results )
+{
+#ifdef PPODD_STATS_SIMD
+  if( const size_t W = simd_width; W > 1 ) {
+    // Process short modules W at a time, one per lane. Their results are
+    // the same as from Analyze(), which handles everything else.
+    int ret = 0;
+    Span<const double> x[MAXLANES];
+    size_t ev[MAXLANES], n = 0;
+    auto analyze_lanes = [&] {
+      LaneStats lanes[MAXLANES];
+      stats_lanes( x, n, soa, lanes );
+      for( size_t l = 0; l < n; ++l ) {
+        const auto& ln = lanes[l];
+        Clear();
+        nval = double(x[l].size());
+        SetResults( ln.sum, ln.min, ln.max, ln.bad ? logsum_scalar(x[l]) : ln.logsum() );
+        StoreResults( results[ev[l]] );
+      }
+      n = 0;
+    };
+    for( size_t i = 0; i < evdata.size(); ++i ) {
+      Clear();
+      cur_row = results[i];
+      int status = Decode(evdata[i]);
+      if( status == 0 && !data.empty() && data.size() < SIMD_MIN_DATA ) {
+        x[n] = data;
+        ev[n] = i;
+        if( ++n == W )
+          analyze_lanes();
+        continue;
+      }
+      if( status == 0 )
+        status = Analyze();
+      if( status != 0 )
+        ret = status;
+      StoreResults( results[i] );
+    }
+    // Last, partial group. The remaining lanes are empty.
+    if( n > 0 )
+      analyze_lanes();
+    return ret;
+  }
+#endif
+  return Detector::AnalyzeBatch( evdata, results );
+}
+
 void DetectorTypeA::Print() const
 {
   Detector::Print();
@@ -19,6 +19,7 @@ public:
   int  Decode( Decoder& evdata ) override;
   int  Analyze() override;
   void Print() const override;
+  int  AnalyzeBatch( Span<Decoder> evdata, ResultRows results ) override;
 
 protected:
   // Statistics results
@@ -29,7 +30,12 @@ protected:
   double mean{};
   double geom{};
 
+  // Data of a batch of events, transposed for the SIMD kernels
+  std::vector<double> soa;
+
   int  DefineVariables( bool remove ) override;
+  // Set results from the sum, extrema and sum of log|x| of 'nval' values
+  void SetResults( double s, double lo, double hi, double logsum );
 };
 
 #endif
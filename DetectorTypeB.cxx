@@ -2,11 +2,165 @@
 
 #include "Podd.h"
 #include "DetectorTypeB.h"
+#include "Decoder.h"
+#include <algorithm>
 #include <iostream>
 #include <cmath>
+#include <cstdint>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define PPODD_FIT_SIMD
+#endif
 
 using namespace std;
 
+// Fit kernels. The kernels process W lanes at once. Point (k,l) is
+// (xs[k*W+l], ys[k*W+l]); lane l holds count[l] points. This covers both
+// the points of one module and a batch of W modules, one per lane.
+// See also DetectorTypeA.cxx.
+
+static constexpr size_t MAXLANES = 8;
+// Modules with fewer points are processed one per lane, which gives the
+// same results as the scalar code. Longer ones are spread over the lanes.
+// (Built with -ffp-contract=off, so that the kernels round like the
+// scalar code.)
+static constexpr size_t SIMD_MIN_POINTS = 16;
+
+// Sums over the points of one lane, without S11 (= number of points)
+struct FitSums {
+  double S12, S22, G1, G2;
+};
+
+#ifdef PPODD_FIT_SIMD
+__attribute__((target("avx2")))
+static void fit_sums_avx2( const double* xs, const double* ys, size_t nrow,
+                           const int64_t* count, FitSums* out )
+{
+  constexpr size_t W = 4;
+  const __m256i vcount = _mm256_loadu_si256( (const __m256i*)count );
+  __m256d s12 = _mm256_setzero_pd(), s22 = s12, g1 = s12, g2 = s12;
+  __m256i k = _mm256_setzero_si256();
+  for( size_t r = 0; r < nrow; ++r ) {
+    // Masked-off points load as (0,0) and add nothing
+    __m256i valid = _mm256_cmpgt_epi64(vcount, k);
+    __m256d x = _mm256_maskload_pd(xs + W*r, valid);
+    __m256d y = _mm256_maskload_pd(ys + W*r, valid);
+    s12 = _mm256_add_pd(s12, x);
+    s22 = _mm256_add_pd(s22, _mm256_mul_pd(x, x));
+    g1  = _mm256_add_pd(g1, y);
+    g2  = _mm256_add_pd(g2, _mm256_mul_pd(x, y));
+    k = _mm256_add_epi64(k, _mm256_set1_epi64x(1));
+  }
+  alignas(32) double a[W], b[W], c[W], d[W];
+  _mm256_store_pd(a, s12);
+  _mm256_store_pd(b, s22);
+  _mm256_store_pd(c, g1);
+  _mm256_store_pd(d, g2);
+  for( size_t l = 0; l < W; ++l )
+    out[l] = { a[l], b[l], c[l], d[l] };
+}
+
+__attribute__((target("avx2")))
+static void fit_chi2_avx2( const double* xs, size_t nrow, const int64_t* count,
+                           const double* inter, const double* slope, double* chi2 )
+{
+  constexpr size_t W = 4;
+  const __m256i vcount = _mm256_loadu_si256( (const __m256i*)count );
+  const __m256d a = _mm256_loadu_pd(inter);
+  const __m256d b = _mm256_loadu_pd(slope);
+  __m256d sum = _mm256_setzero_pd();
+  __m256i k = _mm256_setzero_si256();
+  for( size_t r = 0; r < nrow; ++r ) {
+    __m256i valid = _mm256_cmpgt_epi64(vcount, k);
+    __m256d x = _mm256_maskload_pd(xs + W*r, valid);
+    __m256d d = _mm256_add_pd(a, _mm256_mul_pd(b, x));
+    d = _mm256_and_pd(d, _mm256_castsi256_pd(valid));
+    sum = _mm256_add_pd(sum, _mm256_mul_pd(d, d));
+    k = _mm256_add_epi64(k, _mm256_set1_epi64x(1));
+  }
+  _mm256_storeu_pd(chi2, sum);
+}
+
+__attribute__((target("avx512f")))
+static void fit_sums_avx512( const double* xs, const double* ys, size_t nrow,
+                             const int64_t* count, FitSums* out )
+{
+  constexpr size_t W = 8;
+  const __m512i vcount = _mm512_loadu_si512( count );
+  __m512d s12 = _mm512_setzero_pd(), s22 = s12, g1 = s12, g2 = s12;
+  __m512i k = _mm512_setzero_si512();
+  for( size_t r = 0; r < nrow; ++r ) {
+    __mmask8 valid = _mm512_cmpgt_epi64_mask(vcount, k);
+    __m512d x = _mm512_maskz_loadu_pd(valid, xs + W*r);
+    __m512d y = _mm512_maskz_loadu_pd(valid, ys + W*r);
+    s12 = _mm512_add_pd(s12, x);
+    s22 = _mm512_add_pd(s22, _mm512_mul_pd(x, x));
+    g1  = _mm512_add_pd(g1, y);
+    g2  = _mm512_add_pd(g2, _mm512_mul_pd(x, y));
+    k = _mm512_add_epi64(k, _mm512_set1_epi64(1));
+  }
+  alignas(64) double a[W], b[W], c[W], d[W];
+  _mm512_store_pd(a, s12);
+  _mm512_store_pd(b, s22);
+  _mm512_store_pd(c, g1);
+  _mm512_store_pd(d, g2);
+  for( size_t l = 0; l < W; ++l )
+    out[l] = { a[l], b[l], c[l], d[l] };
+}
+
+__attribute__((target("avx512f")))
+static void fit_chi2_avx512( const double* xs, size_t nrow, const int64_t* count,
+                             const double* inter, const double* slope, double* chi2 )
+{
+  constexpr size_t W = 8;
+  const __m512i vcount = _mm512_loadu_si512( count );
+  const __m512d a = _mm512_loadu_pd(inter);
+  const __m512d b = _mm512_loadu_pd(slope);
+  __m512d sum = _mm512_setzero_pd();
+  __m512i k = _mm512_setzero_si512();
+  for( size_t r = 0; r < nrow; ++r ) {
+    __mmask8 valid = _mm512_cmpgt_epi64_mask(vcount, k);
+    __m512d x = _mm512_maskz_loadu_pd(valid, xs + W*r);
+    __m512d d = _mm512_maskz_add_pd(valid, a, _mm512_mul_pd(b, x));
+    sum = _mm512_add_pd(sum, _mm512_mul_pd(d, d));
+    k = _mm512_add_epi64(k, _mm512_set1_epi64(1));
+  }
+  _mm512_storeu_pd(chi2, sum);
+}
+
+// Number of lanes of the best kernels supported by this CPU, 1 = none
+static const size_t simd_width =
+  __builtin_cpu_supports("avx512f") ? 8 : __builtin_cpu_supports("avx2") ? 4 : 1;
+
+static void fit_sums( const double* xs, const double* ys, size_t nrow,
+                      const int64_t* count, FitSums* out )
+{
+  if( simd_width == 8 )
+    fit_sums_avx512( xs, ys, nrow, count, out );
+  else
+    fit_sums_avx2( xs, ys, nrow, count, out );
+}
+
+static void fit_chi2( const double* xs, size_t nrow, const int64_t* count,
+                      const double* inter, const double* slope, double* chi2 )
+{
+  if( simd_width == 8 )
+    fit_chi2_avx512( xs, nrow, count, inter, slope, chi2 );
+  else
+    fit_chi2_avx2( xs, nrow, count, inter, slope, chi2 );
+}
+#else
+static constexpr size_t simd_width = 1;
+#endif
+
+static const bool registered = RegisterDetectorType("B",
+  []( const string& name, int imod, const vector<string>& args ) -> unique_ptr<Detector> {
+    if( !args.empty() )
+      return nullptr;
+    return make_unique<DetectorTypeB>(name, imod);
+  });
+
 DetectorTypeB::DetectorTypeB( const std::string& name, int imod )
   : Detector(name, imod)
 {
@@ -30,6 +184,18 @@ unique_ptr<Detector> DetectorTypeB::Clone() const
   return make_unique<DetectorTypeB>(*this);
 }
 
+void DetectorTypeB::SetFit( size_t n, double S12, double S22, double G1, double G2 )
+{
+  double S11 = double(n);
+  double D = 1.0 / (S11*S22 - S12*S12);
+  inter = (G1*S22 - G2*S12)*D;
+  slope = (G2*S11 - G1*S12)*D;
+  cov11 = S11*D;
+  cov22 = S22*D;
+  cov12 = -S12*D;
+  ndof = double(n)-2.0;
+}
+
 int DetectorTypeB::Analyze()
 {
   // This detector type performs a linear fit to the data
@@ -39,35 +205,137 @@ int DetectorTypeB::Analyze()
 	 << ", expected even number" << endl;
     return 1;
   }
-  if( size_t n = data.size()/2; n >= 3 ) {
-    double S11 = 0, S12 = 0, S22 = 0, G1 = 0, G2 = 0;
+  size_t n = data.size()/2;
+  if( n < 3 )
+    return 0;
+
+#ifdef PPODD_FIT_SIMD
+  if( const size_t W = simd_width; W > 1 && n >= SIMD_MIN_POINTS ) {
+    // Vectorize across the points: lane l gets points l, l+W, l+2W, ...
+    soa.resize(2*n);
+    double* xs = soa.data();
+    double* ys = xs + n;
     for( size_t i = 0; i < n; ++i ) {
-      double x = data[2*i];
-      double y = data[2*i+1];
-      S11 += 1.0;
-      S12 += x;
-      S22 += x*x;
-      G1  += y;
-      G2  += x*y;
+      xs[i] = data[2*i];
+      ys[i] = data[2*i+1];
     }
-    double D = 1.0 / (S11*S22 - S12*S12);
-    inter = (G1*S22 - G2*S12)*D;
-    slope = (G2*S11 - G1*S12)*D;
-    cov11 = S11*D;
-    cov22 = S22*D;
-    cov12 = -S12*D;
-    chi2 = 0;
-    for( size_t i = 0; i < n; ++i ) {
-      double x = data[2*i];
-      double d = inter + slope*x;
-      chi2 += d*d;
+    int64_t count[MAXLANES];
+    for( size_t l = 0; l < W; ++l )
+      count[l] = (n - l + W - 1) / W;
+    FitSums lanes[MAXLANES];
+    fit_sums( xs, ys, count[0], count, lanes );
+    FitSums t = lanes[0];
+    for( size_t l = 1; l < W; ++l ) {
+      t.S12 += lanes[l].S12;
+      t.S22 += lanes[l].S22;
+      t.G1  += lanes[l].G1;
+      t.G2  += lanes[l].G2;
     }
-    ndof = double(n)-2.0;
+    SetFit( n, t.S12, t.S22, t.G1, t.G2 );
+    double a[MAXLANES], b[MAXLANES], c2[MAXLANES];
+    fill_n( a, W, inter );
+    fill_n( b, W, slope );
+    fit_chi2( xs, count[0], count, a, b, c2 );
+    chi2 = 0;
+    for( size_t l = 0; l < W; ++l )
+      chi2 += c2[l];
+    return 0;
+  }
+#endif
+  double S12 = 0, S22 = 0, G1 = 0, G2 = 0;
+  for( size_t i = 0; i < n; ++i ) {
+    double x = data[2*i];
+    double y = data[2*i+1];
+    S12 += x;
+    S22 += x*x;
+    G1  += y;
+    G2  += x*y;
+  }
+  SetFit( n, S12, S22, G1, G2 );
+  chi2 = 0;
+  for( size_t i = 0; i < n; ++i ) {
+    double x = data[2*i];
+    double d = inter + slope*x;
+    chi2 += d*d;
   }
 
   return 0;
 }
 
+int DetectorTypeB::AnalyzeBatch( Span<Decoder> evdata, ResultRows results )
+{
+#ifdef PPODD_FIT_SIMD
+  if( const size_t W = simd_width; W > 1 ) {
+    // Fit short modules W at a time, one per lane. Their results are the
+    // same as from Analyze(), which handles everything else.
+    int ret = 0;
+    Span<const double> pts[MAXLANES];
+    size_t ev[MAXLANES], n = 0;
+    auto analyze_lanes = [&] {
+      // Transpose. Unused lanes have count 0, and points beyond each
+      // lane's count are never read.
+      int64_t count[MAXLANES] = {};
+      size_t nrow = 0;
+      for( size_t l = 0; l < n; ++l ) {
+        count[l] = int64_t(pts[l].size() / 2);
+        nrow = std::max<size_t>(nrow, count[l]);
+      }
+      soa.resize(2 * nrow * W);
+      double* xs = soa.data();
+      double* ys = xs + nrow * W;
+      for( size_t l = 0; l < n; ++l ) {
+        for( int64_t k = 0; k < count[l]; ++k ) {
+          xs[k*W + l] = pts[l][2*k];
+          ys[k*W + l] = pts[l][2*k+1];
+        }
+      }
+      FitSums lanes[MAXLANES];
+      fit_sums( xs, ys, nrow, count, lanes );
+      double a[MAXLANES] = {}, b[MAXLANES] = {}, c2[MAXLANES];
+      for( size_t l = 0; l < n; ++l ) {
+        const auto& t = lanes[l];
+        SetFit( count[l], t.S12, t.S22, t.G1, t.G2 );
+        a[l] = inter;
+        b[l] = slope;
+      }
+      fit_chi2( xs, nrow, count, a, b, c2 );
+
+      for( size_t l = 0; l < n; ++l ) {
+        const auto& t = lanes[l];
+        Clear();
+        SetFit( count[l], t.S12, t.S22, t.G1, t.G2 );
+        chi2 = c2[l];
+        StoreResults( results[ev[l]] );
+      }
+      n = 0;
+    };
+    for( size_t i = 0; i < evdata.size(); ++i ) {
+      Clear();
+      cur_row = results[i];
+      int status = Decode(evdata[i]);
+      if( size_t np = data.size() / 2; status == 0 && data.size() % 2 == 0 &&
+          np >= 3 && np < SIMD_MIN_POINTS ) {
+        pts[n] = data;
+        ev[n] = i;
+        if( ++n == W )
+          analyze_lanes();
+        continue;
+      }
+      if( status == 0 )
+        status = Analyze();
+      if( status != 0 )
+        ret = status;
+      StoreResults( results[i] );
+    }
+    // Last, partial group. The remaining lanes are empty.
+    if( n > 0 )
+      analyze_lanes();
+    return ret;
+  }
+#endif
+  return Detector::AnalyzeBatch( evdata, results );
+}
+
 void DetectorTypeB::Print() const
 {
   Detector::Print();
@@ -18,6 +18,7 @@ public:
   [[nodiscard]] std::unique_ptr<Detector> Clone() const override;
   int  Analyze() override;
   void Print() const override;
+  int  AnalyzeBatch( Span<Decoder> evdata, ResultRows results ) override;
 
 protected:
   // Fit results
@@ -29,7 +30,13 @@ protected:
   double ndof{};
   double chi2{};
 
+  // x and y values of one event or a batch of events, transposed for the
+  // SIMD kernels
+  std::vector<double> soa;
+
   int  DefineVariables( bool remove ) override;
+  // Set the fit results, except chi2, from the sums over 'n' points
+  void SetFit( size_t n, double S12, double S22, double G1, double G2 );
 };
 
 #endif
@@ -7,14 +7,26 @@
 #include "Podd.h"
 #include "Decoder.h"
 #include "Database.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
 #include <cstdlib>
+#include <mutex>
 #include <stdexcept>
 //#include <cassert>
 
 using namespace std;
 
+static const bool registered = RegisterDetectorType("C",
+  []( const string& name, int imod, const vector<string>& args ) -> unique_ptr<Detector> {
+    if( !args.empty() )
+      return nullptr;
+    return make_unique<DetectorTypeC>(name, imod);
+  });
+
 DetectorTypeC::DetectorTypeC( const string& name, int imod )
-  : Detector(name, imod), m_ndig(0), m_last5(0), m_scale(1.0)
+  : Detector(name, imod), m_ndig(0), m_last5(0), m_scale(1.0),
+    m_mode(kCompute), m_spigot(kLargeBase)
 {
   type = "C";
 
@@ -40,10 +52,171 @@ unique_ptr<Detector> DetectorTypeC::Clone() const
 }
 
 
+// Large-base spigot kernels
+//
+// A pass multiplies the mixed-radix workspace by c = 10^k instead of 10 and
+// normalizes it from the top position down. This leaves the workspace
+// exactly as k passes of the classic algorithm would, and the value
+// extracted at position 0, D = floor(v/10), equals sum_i Q_i*10^(k-i),
+// where Q_1..Q_k are the classic algorithm's predigits.
+//
+// The normalization is a chain of dependent divisions, which cannot be
+// vectorized within a pass. The SIMD kernels therefore run W consecutive
+// passes as a wavefront: lane l processes pass p+l at position x+l, taking
+// the value that lane l-1 left there in the previous step. Divisions use
+// the precomputed inverse of the divisor and a correction step, which is
+// exact because all values stay below 2^52.
+
+static constexpr size_t MAXLANES = 8;
+// Largest exactly computed workspace value
+static constexpr double SPIGOT_MAX = 0x1p52;
+
+static inline void divmod( double v, double d, double inv, double& q, double& r )
+{
+  q = floor(v * inv);
+  r = v - q * d;
+  if( r < 0 ) {
+    q -= 1;
+    r += d;
+  } else if( r >= d ) {
+    q += 1;
+    r -= d;
+  }
+}
+
+// Run one pass with multiplier c over positions N-1 ... 0 of w and return
+// the extracted digit group
+static double spigot_pass( double* w, ptrdiff_t N, const double* den,
+                           const double* inv, const double* wgt, double c )
+{
+  double carry = 0, q = 0, r = 0;
+  for( ptrdiff_t x = N-1; x >= 0; --x ) {
+    divmod( w[x] * c + carry, den[x], inv[x], q, r );
+    w[x] = r;
+    carry = q * wgt[x];
+  }
+  return q;
+}
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define PPODD_SPIGOT_SIMD
+
+// Run passes with multipliers c[0..W-1] as a wavefront, see above.
+// w, den, inv and wgt must be addressable at positions -W+1 ... N+W-2,
+// with w = 0, den = inv = 1 and wgt = 0 at negative positions.
+__attribute__((target("avx2")))
+static void spigot_avx2( double* w, ptrdiff_t N, const double* den,
+                         const double* inv, const double* wgt,
+                         const double* c, double* groups )
+{
+  constexpr ptrdiff_t W = 4;
+  const __m256d vc = _mm256_loadu_pd(c);
+  const __m256d zero = _mm256_setzero_pd();
+  const __m256d one = _mm256_set1_pd(1.0);
+  __m256d r = zero, carry = zero;
+  alignas(32) double qs[W];
+  for( ptrdiff_t x = N-1; x > -W; --x ) {
+    // Lane l is at position x+l. Lane 0 starts from the previous wavefront's
+    // result, the others from what the next lower lane just left.
+    __m256d a = _mm256_permute4x64_pd(r, _MM_SHUFFLE(2,1,0,0));
+    a = _mm256_blend_pd(a, _mm256_broadcast_sd(w+x), 1);
+    __m256d v = _mm256_add_pd(_mm256_mul_pd(a, vc), carry);
+    __m256d d = _mm256_loadu_pd(den+x);
+    __m256d q = _mm256_floor_pd(_mm256_mul_pd(v, _mm256_loadu_pd(inv+x)));
+    r = _mm256_sub_pd(v, _mm256_mul_pd(q, d));
+    __m256d lo = _mm256_cmp_pd(r, zero, _CMP_LT_OQ);
+    q = _mm256_sub_pd(q, _mm256_and_pd(lo, one));
+    r = _mm256_add_pd(r, _mm256_and_pd(lo, d));
+    __m256d hi = _mm256_cmp_pd(r, d, _CMP_GE_OQ);
+    q = _mm256_add_pd(q, _mm256_and_pd(hi, one));
+    r = _mm256_sub_pd(r, _mm256_and_pd(hi, d));
+    carry = _mm256_mul_pd(q, _mm256_loadu_pd(wgt+x));
+    // The last lane completes the wavefront at its position
+    _mm_storeh_pd(w+x+W-1, _mm256_extractf128_pd(r, 1));
+    if( x <= 0 ) {
+      _mm256_store_pd(qs, q);
+      groups[-x] = qs[-x];
+    }
+  }
+}
+
+__attribute__((target("avx512f")))
+static void spigot_avx512( double* w, ptrdiff_t N, const double* den,
+                           const double* inv, const double* wgt,
+                           const double* c, double* groups )
+{
+  constexpr ptrdiff_t W = 8;
+  const __m512d vc = _mm512_loadu_pd(c);
+  const __m512d one = _mm512_set1_pd(1.0);
+  const __m512i shift = _mm512_set_epi64(6,5,4,3,2,1,0,0);
+  __m512d r = _mm512_setzero_pd(), carry = _mm512_setzero_pd();
+  for( ptrdiff_t x = N-1; x > -W; --x ) {
+    // (maskz_ forms avoid spurious uninitialized warnings with GCC 12)
+    __m512d a = _mm512_maskz_permutexvar_pd(0xFF, shift, r);
+    a = _mm512_mask_mov_pd(a, 1, _mm512_set1_pd(w[x]));
+    __m512d v = _mm512_add_pd(_mm512_mul_pd(a, vc), carry);
+    __m512d d = _mm512_loadu_pd(den+x);
+    __m512d q = _mm512_maskz_roundscale_pd(0xFF, _mm512_mul_pd(v, _mm512_loadu_pd(inv+x)),
+                                           _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+    r = _mm512_sub_pd(v, _mm512_mul_pd(q, d));
+    __mmask8 lo = _mm512_cmp_pd_mask(r, _mm512_setzero_pd(), _CMP_LT_OQ);
+    q = _mm512_mask_sub_pd(q, lo, q, one);
+    r = _mm512_mask_add_pd(r, lo, r, d);
+    __mmask8 hi = _mm512_cmp_pd_mask(r, d, _CMP_GE_OQ);
+    q = _mm512_mask_add_pd(q, hi, q, one);
+    r = _mm512_mask_sub_pd(r, hi, r, d);
+    carry = _mm512_mul_pd(q, _mm512_loadu_pd(wgt+x));
+    _mm512_mask_storeu_pd(w+x, 0x80, r);
+    if( x <= 0 )
+      _mm512_mask_storeu_pd(groups, __mmask8(1U << -x), q);
+  }
+}
+
+// Number of lanes of the best kernel supported by this CPU, 1 = none
+static const size_t simd_width =
+  __builtin_cpu_supports("avx512f") ? 8 : __builtin_cpu_supports("avx2") ? 4 : 1;
+#else
+static constexpr size_t simd_width = 1;
+#endif
+
+int DetectorTypeC::NumDigits() const
+{
+  int n = 0;
+  if( !data.empty() )
+    n = int(data[0]*m_scale);
+  if( n < 1 )
+    n = 10;
+  return n;
+}
+
+// The results depend only on the number of digits
+void DetectorTypeC::GetCacheKey( vector<double>& key ) const
+{
+  key.assign(1, NumDigits());
+}
+
 int DetectorTypeC::Analyze()
 {
   // This detector type computes n digits of pi
-  //
+
+  int n = NumDigits();
+
+  if( m_mode == kTable )
+    LookUp(n);
+  else if( m_spigot == kClassic )
+    SpigotClassic(n);
+  else
+    SpigotLargeBase(n);
+
+  m_ndig = n;
+  m_last5 = std::stod(m_result.substr(m_result.length() - 5, 5));
+
+  return 0;
+}
+
+void DetectorTypeC::SpigotClassic( int n )
+{
   // Attempts to implement the algorithm from
   // Rabinowitz and Wagon, "A spigot algorithm for the digits of Pi",
   // American Mathematical Monthly, 102 (3), 195–203 (March 1995),
@@ -53,12 +226,6 @@ int DetectorTypeC::Analyze()
   // last digit wrong. Compare the results for n = 50 and n = 51 for example.
   // We ignore this problem here.
 
-  int n = 0;
-  if( !data.empty() )
-    n = int(data[0]*m_scale);
-  if( n < 1 )
-    n = 10;
-
   int N = (10*n)/3;
 
   m_a.assign(N,2);
@@ -108,11 +275,140 @@ int DetectorTypeC::Analyze()
     m_result += char('0'+last_digit);
 
   //assert( m_result.length() == n+1 ); // This sometimes trips, exposing the bug mentioned above
+}
 
-  m_ndig = n;
-  m_last5 = std::stod(m_result.substr(m_result.length() - 5, 5));
+void DetectorTypeC::SpigotLargeBase( int n )
+{
+  // Same algorithm and workspace size as SpigotClassic, extracting k digits
+  // per pass, see the kernels above. The classic digit output is the
+  // decimal expansion of sum_i Q_i*10^(n-i) without its trailing nines,
+  // which are still pending when it stops. That is reproduced here.
 
-  return 0;
+  static constexpr uint64_t pow10[] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000,
+    1000000000, 10000000000, 100000000000, 1000000000000,
+    10000000000000, 100000000000000, 1000000000000000
+  };
+  constexpr int KMAX = sizeof(pow10)/sizeof(pow10[0]) - 1;
+
+  const ptrdiff_t N = (10*n)/3;
+  const ptrdiff_t W = simd_width, PAD = MAXLANES;
+
+  // Workspace values stay below 6*N*10^k
+  int k = 1;
+  while( k < KMAX && 6.0 * double(N) * double(pow10[k+1]) <= SPIGOT_MAX )
+    ++k;
+  const int npass = (n+k-1)/k;
+
+  // Per-position tables, padded on both sides for the wavefront kernels
+  if( ptrdiff_t(m_div.size()) < N+2*PAD ) {
+    const ptrdiff_t len = N+2*PAD;
+    m_div.resize(len);
+    m_inv.resize(len);
+    m_wgt.resize(len);
+    for( ptrdiff_t i = 0; i < len; ++i ) {
+      ptrdiff_t x = i-PAD;
+      m_div[i] = x > 0 ? double(2*x+1) : x == 0 ? 10.0 : 1.0;
+      m_inv[i] = 1.0/m_div[i];
+      m_wgt[i] = x > 0 ? double(x) : 0.0;
+    }
+  }
+  m_w.assign(N+2*PAD, 0.0);
+  fill_n(m_w.begin()+PAD, N, 2.0);
+  double* w = m_w.data()+PAD;
+  const double* den = m_div.data()+PAD;
+  const double* inv = m_inv.data()+PAD;
+  const double* wgt = m_wgt.data()+PAD;
+
+  auto ndigits = [n,k,npass]( int pass ) {
+    return pass+1 < npass ? k : n-k*(npass-1);
+  };
+  m_groups.resize(npass+MAXLANES);
+  int pass = 0;
+#ifdef PPODD_SPIGOT_SIMD
+  if( W > 1 ) {
+    for( ; pass < npass; pass += W ) {
+      // Lanes past the last pass run harmless passes with c = 1
+      double c[MAXLANES];
+      for( ptrdiff_t l = 0; l < W; ++l )
+        c[l] = pass+l < npass ? double(pow10[ndigits(pass+l)]) : 1.0;
+      if( W == 8 )
+        spigot_avx512( w, N, den, inv, wgt, c, &m_groups[pass] );
+      else
+        spigot_avx2( w, N, den, inv, wgt, c, &m_groups[pass] );
+    }
+  }
+#endif
+  for( ; pass < npass; ++pass )
+    m_groups[pass] = spigot_pass( w, N, den, inv, wgt, double(pow10[ndigits(pass)]) );
+
+  // Assemble the digits. A group can exceed 10^k, carrying into the
+  // digits already produced.
+  m_result.clear();
+  m_result.reserve(n+1);
+  for( pass = 0; pass < npass; ++pass ) {
+    const int nd = ndigits(pass);
+    auto g = uint64_t(m_groups[pass]);
+    uint64_t carry = g / pow10[nd];
+    g -= carry * pow10[nd];
+    for( size_t i = m_result.size(); carry != 0 && i-- > 0; ) {
+      uint64_t d = m_result[i]-'0' + carry;
+      m_result[i] = char('0' + d%10);
+      carry = d/10;
+    }
+    const size_t pos = m_result.size();
+    m_result.append(nd, '0');
+    for( int i = nd; i-- > 0; g /= 10 )
+      m_result[pos+i] = char('0' + g%10);
+  }
+  while( m_result.size() > 1 && m_result.back() == '9' )
+    m_result.pop_back();
+  if( m_result.size() > 1 )
+    m_result.insert(1, 1, '.');
+}
+
+// Digits of pi, without the decimal point, shared by all instances.
+// Published tables are never modified. A larger one replaces the current
+// one when needed, while instances may still hold the old one.
+static shared_ptr<const string> digit_table;
+static mutex digit_table_mutex;
+
+// The spigot algorithms get the last few digits wrong. Computing this many
+// extra digits keeps the errors out of the table.
+static constexpr int TABLE_GUARD_DIGITS = 16;
+
+shared_ptr<const string> DetectorTypeC::GetDigitTable( int n )
+{
+  auto table = atomic_load(&digit_table);
+  if( table && table->size() >= size_t(n) )
+    return table;
+
+  lock_guard lock(digit_table_mutex);
+  table = atomic_load(&digit_table);
+  if( table && table->size() >= size_t(n) )
+    return table;
+  // Leave room for the usual spread of n before the next extension
+  size_t len = n + n/4;
+  SpigotLargeBase( int(len) + TABLE_GUARD_DIGITS );
+  m_result.erase(1, 1);
+  m_result.resize(len);
+  table = make_shared<const string>(std::move(m_result));
+  m_result.clear();
+  atomic_store(&digit_table, table);
+  return table;
+}
+
+void DetectorTypeC::LookUp( int n )
+{
+  if( !m_digits || m_digits->size() < size_t(n) )
+    m_digits = GetDigitTable(n);
+
+  // Keep what Analyze() uses of the full result "3.14159..."
+  const string& d = *m_digits;
+  if( n > 5 )
+    m_result.assign(d, n-5, 5);
+  else
+    m_result.assign(d, 0, n).insert(1, n > 1 ? "." : "");
 }
 
 void DetectorTypeC::Print() const
@@ -140,6 +436,14 @@ int DetectorTypeC::ReadDatabase( bool shared )
     // If so, assign its value to m_scale. Otherwise m_scale = 1.0
     auto val = database.Get("scale", name);
     m_scale = val.value_or(1.0);
+    // "detC.mode" selects computation or table lookup, see EMode,
+    // "detC.spigot" the algorithm for computing, see ESpigot
+    auto mode = database.Get("mode", name);
+    m_mode = (mode && int(*mode) == kTable) ? kTable : kCompute;
+    auto alg = database.Get("spigot", name);
+    m_spigot = (alg && int(*alg) == kClassic) ? kClassic : kLargeBase;
+    // "detC.cache" = 1 enables the result cache, see Detector::use_cache
+    use_cache = database.Get("cache", name).value_or(0) != 0;
   }
 
   return 0;
@@ -1,12 +1,18 @@
 // Simple detector example class
 //
 // This detector type computes N digits of pi, where N is taken from
-// the raw data input file
+// the raw data input file. The database key "spigot" selects the
+// algorithm, see ESpigot. Both give identical results. The key "mode"
+// selects looking the digits up in a table shared by all instances
+// instead, see EMode. The table holds the true digits of pi, which the
+// spigot algorithms sometimes get wrong in the last digit or two, so
+// "last8" can differ between the modes.
 
 #ifndef PPODD_DETECTORC
 #define PPODD_DETECTORC
 
 #include "Detector.h"
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -14,6 +20,18 @@ class Decoder;
 
 class DetectorTypeC : public Detector {
 public:
+  // Modes of operation
+  enum EMode {
+    kCompute = 0,  // Compute the digits for each event (default)
+    kTable   = 1   // Look up the digits in the shared table
+  };
+
+  // Spigot algorithm variants
+  enum ESpigot {
+    kClassic   = 0,  // One digit per pass over an int workspace
+    kLargeBase = 1   // Several digits per pass, vectorized (default)
+  };
+
   DetectorTypeC( const std::string& name, int imod );
   ~DetectorTypeC() override;
 
@@ -25,12 +43,36 @@ public:
 protected:
   std::vector<int> m_a;       // Workspace
   std::string      m_result;  // Result as string representation of a decimal number
+                              // (kTable: only its last 5 characters)
   double           m_ndig;    // Number of digits computed (taken from raw data)
   double           m_last5;   // Last 5 digits of result (for illustration)
   double           m_scale;   // Scale factor for number of digits input value
+  int              m_mode;    // Mode of operation, see EMode
+  int              m_spigot;  // Algorithm, see ESpigot
+
+  // Snapshot of the shared digit table, see GetDigitTable()
+  std::shared_ptr<const std::string> m_digits;
+
+  // kLargeBase workspace, holding integers exactly, and the divisor, its
+  // inverse and the carry weight of each workspace position
+  std::vector<double> m_w;
+  std::vector<double> m_div, m_inv, m_wgt;
+  std::vector<double> m_groups;  // Digit groups extracted by each pass
 
   int  DefineVariables( bool remove ) override;
   int  ReadDatabase( bool shared ) override;
+  void GetCacheKey( std::vector<double>& key ) const override;
+
+  // Number of digits requested by the current event
+  [[nodiscard]] int NumDigits() const;
+
+  // Compute n digits of pi into m_result
+  void SpigotClassic( int n );
+  void SpigotLargeBase( int n );
+  // Look up n digits of pi in the shared table
+  void LookUp( int n );
+  // Get a snapshot of the shared table with at least n digits
+  std::shared_ptr<const std::string> GetDigitTable( int n );
 };
 
 #endif
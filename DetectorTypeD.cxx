@@ -0,0 +1,77 @@
+// Simple detector class combining the results of other detectors
+
+#include "Podd.h"
+#include "DetectorTypeD.h"
+#include <iostream>
+#include <cmath>
+
+using namespace std;
+
+// The arguments are the input variables
+static const bool registered = RegisterDetectorType("D",
+  []( const string& name, int imod, const vector<string>& args ) -> unique_ptr<Detector> {
+    if( imod != 0 || args.empty() )
+      return nullptr;
+    return make_unique<DetectorTypeD>(name, args);
+  });
+
+DetectorTypeD::DetectorTypeD( const string& name, vector<string> invars )
+  : Detector(name, 0)
+{
+  type = "D";
+  inputs = std::move(invars);
+}
+
+DetectorTypeD::~DetectorTypeD()
+{
+  DetectorTypeD::DefineVariables( kRemove );
+}
+
+void DetectorTypeD::Clear()
+{
+  Detector::Clear();
+  nval = sum = max = 0;
+}
+
+unique_ptr<Detector> DetectorTypeD::Clone() const
+{
+  return make_unique<DetectorTypeD>(*this);
+}
+
+int DetectorTypeD::Analyze()
+{
+  // Sum and maximum of the finite input values
+
+  for( size_t j = 0; j < inputs.size(); ++j ) {
+    double val = GetInput(j);
+    if( !isfinite(val) )
+      continue;
+    if( nval == 0 || val > max )
+      max = val;
+    sum += val;
+    ++nval;
+  }
+
+  return 0;
+}
+
+void DetectorTypeD::Print() const
+{
+  Detector::Print();
+  if( debug > 1 ) {
+    cout << " Inputs:";
+    for( const auto& input : inputs )
+      cout << " " << input;
+    cout << endl;
+  }
+}
+
+int DetectorTypeD::DefineVariables( bool do_remove )
+{
+  const vector<VarDef_t> defs = {
+          {"nval", "Number of finite inputs", &nval},
+          {"sum",  "Sum of inputs",           &sum},
+          {"max",  "Maximum of inputs",       &max}
+  };
+  return DefineVarsFromList(defs, GetName(), fVars, do_remove);
+}
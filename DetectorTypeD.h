@@ -0,0 +1,33 @@
+// Simple detector example class
+//
+// This detector type reads no raw data. It combines the results of other
+// detectors, given as the names of their variables, and so depends on
+// them (see Context::Init).
+
+#ifndef PPODD_DETECTORD
+#define PPODD_DETECTORD
+
+#include "Detector.h"
+#include <string>
+#include <vector>
+
+class DetectorTypeD : public Detector {
+public:
+  DetectorTypeD( const std::string& name, std::vector<std::string> invars );
+  ~DetectorTypeD() override;
+
+  void Clear() override;
+  [[nodiscard]] std::unique_ptr<Detector> Clone() const override;
+  int  Analyze() override;
+  void Print() const override;
+
+protected:
+  // Combined results
+  double nval{};
+  double sum{};
+  double max{};
+
+  int  DefineVariables( bool remove ) override;
+};
+
+#endif
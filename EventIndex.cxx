@@ -0,0 +1,160 @@
+// Event index for raw data files
+
+#include "EventIndex.h"
+#include "ReadAhead.h"
+#include "rawdata.h"
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+static const char index_magic[8] = { 'P','P','O','D','D','I','D','X' };
+static constexpr uint32_t index_version = 1;
+
+int EventIndex::Build( const string& datafile )
+{
+  // Walk the event headers of 'datafile', skipping over the payloads
+
+  Clear();
+  // Offsets into compressed data would be meaningless
+  if( ReadAhead::DetectCompression(datafile) != ReadAhead::kNone ) {
+    cerr << "Cannot index compressed file " << datafile << endl;
+    return 1;
+  }
+  FILE* fp = fopen( datafile.c_str(), "r" );
+  if( !fp ) {
+    cerr << "Error opening file " << datafile << endl;
+    return 1;
+  }
+  int ret = 0;
+  uint64_t pos = 0;
+  // In blocked files, skip the file header and the block headers.
+  // Plain files are one "block" extending to the end of the file.
+  uint64_t block_end = UINT64_MAX;
+  RawFileHeader fhdr{};
+  if( fread( &fhdr, 1, sizeof(fhdr), fp ) == sizeof(fhdr) &&
+      memcmp( fhdr.magic, RAWFILE_MAGIC, sizeof(RAWFILE_MAGIC) ) == 0 ) {
+    if( fhdr.version != RAWFILE_VERSION || fhdr.header_size < sizeof(fhdr) ) {
+      cerr << "Unsupported raw data format version " << fhdr.version
+           << " in file " << datafile << endl;
+      fclose(fp);
+      return 2;
+    }
+    pos = block_end = fhdr.header_size;
+  }
+  EventHeader hdr;
+  while( fseeko( fp, off_t(pos), SEEK_SET ) == 0 ) {
+    if( pos == block_end ) {
+      RawBlockHeader bhdr{};
+      if( fread( &bhdr, 1, sizeof(bhdr), fp ) != sizeof(bhdr) )
+        break;
+      if( bhdr.magic != RAWBLOCK_MAGIC ) {
+        cerr << "Bad block header at offset " << pos << " in file "
+             << datafile << endl;
+        ret = 2;
+        break;
+      }
+      pos += sizeof(bhdr);
+      block_end = pos + bhdr.length;
+      continue;
+    }
+    if( fread( &hdr, 1, sizeof(hdr), fp ) != sizeof(hdr) )
+      break;
+    if( hdr.event_length < sizeof(hdr) || hdr.event_length > block_end - pos ) {
+      cerr << "Bad event length " << hdr.event_length << " at offset "
+           << pos << " in file " << datafile << endl;
+      ret = 2;
+      break;
+    }
+    m_entries.push_back( {pos, hdr.event_length, hdr.event_info} );
+    pos += hdr.event_length;
+  }
+  if( ret == 0 && ferror(fp) ) {
+    cerr << "Error reading file " << datafile << endl;
+    ret = 2;
+  }
+  // Determine the actual file size. A truncated last event is dropped.
+  if( ret == 0 && fseeko( fp, 0, SEEK_END ) == 0 ) {
+    m_file_size = ftello(fp);
+    if( !m_entries.empty() ) {
+      const auto& last = m_entries.back();
+      if( last.offset + last.length > m_file_size ) {
+        cerr << "Warning: last event in " << datafile
+             << " is truncated, not indexed" << endl;
+        m_entries.pop_back();
+      }
+    }
+  }
+  fclose(fp);
+  if( ret != 0 )
+    Clear();
+  return ret;
+}
+
+int EventIndex::Read( const string& idxfile, uint64_t data_size )
+{
+  Clear();
+  FILE* fp = fopen( idxfile.c_str(), "r" );
+  if( !fp )
+    return 1;
+  IndexHeader hdr{};
+  int ret = 0;
+  if( fread( &hdr, 1, sizeof(hdr), fp ) != sizeof(hdr) ||
+      memcmp( hdr.magic, index_magic, sizeof(index_magic) ) != 0 ||
+      hdr.version != index_version || hdr.entry_size != sizeof(IndexEntry) ) {
+    cerr << "Invalid event index file " << idxfile << endl;
+    ret = 2;
+  } else if( data_size != 0 && hdr.file_size != data_size ) {
+    cerr << "Event index " << idxfile << " does not match its data file, "
+         << "ignored. Rebuild it with mkindex." << endl;
+    ret = 2;
+  } else {
+    m_entries.resize(hdr.nevents);
+    if( fread( m_entries.data(), sizeof(IndexEntry), hdr.nevents, fp )
+        != hdr.nevents ) {
+      cerr << "Error reading event index file " << idxfile << endl;
+      ret = 2;
+    }
+    m_file_size = hdr.file_size;
+  }
+  fclose(fp);
+  if( ret != 0 )
+    Clear();
+  return ret;
+}
+
+int EventIndex::Write( const string& idxfile ) const
+{
+  FILE* fp = fopen( idxfile.c_str(), "wb" );
+  if( !fp ) {
+    cerr << "Cannot open index file " << idxfile << endl;
+    return 1;
+  }
+  IndexHeader hdr{};
+  memcpy( hdr.magic, index_magic, sizeof(index_magic) );
+  hdr.version = index_version;
+  hdr.entry_size = sizeof(IndexEntry);
+  hdr.nevents = m_entries.size();
+  hdr.file_size = m_file_size;
+  int ret = 0;
+  if( fwrite( &hdr, 1, sizeof(hdr), fp ) != sizeof(hdr) ||
+      fwrite( m_entries.data(), sizeof(IndexEntry), m_entries.size(), fp )
+      != m_entries.size() )
+    ret = 2;
+  if( fclose(fp) != 0 )
+    ret = 2;
+  if( ret != 0 )
+    cerr << "Error writing index file " << idxfile << endl;
+  return ret;
+}
+
+vector<size_t> EventIndex::GetSyncEvents() const
+{
+  vector<size_t> evnums;
+  for( size_t i = 0; i < m_entries.size(); ++i ) {
+    if( m_entries[i].info & EVINFO_SYNC )
+      evnums.push_back(i+1);
+  }
+  return evnums;
+}
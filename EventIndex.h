@@ -0,0 +1,77 @@
+// Event index for raw data files
+//
+// The index is a sidecar file, by default named <data file>.idx, holding
+// the byte offset, length and event_info word of every event in the data
+// file. It allows seeking to any event in O(1) and finding special events
+// without reading the event payloads. Build it with the mkindex program.
+//
+// Index file layout:
+//   IndexHeader
+//   nevents * IndexEntry, in file order (event number = entry number + 1)
+
+#ifndef PPODD_EVENTINDEX
+#define PPODD_EVENTINDEX
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+struct IndexHeader {
+  char     magic[8];     // "PPODDIDX"
+  uint32_t version;      // Index format version
+  uint32_t entry_size;   // sizeof(IndexEntry)
+  uint64_t nevents;      // Number of entries following the header
+  uint64_t file_size;    // Size of the indexed data file (bytes)
+} __attribute__((aligned(8)));
+
+struct IndexEntry {
+  uint64_t offset;       // Byte offset of the event in the data file
+  uint32_t length;       // Event length (bytes), i.e. EventHeader::event_length
+  uint32_t info;         // EventHeader::event_info
+} __attribute__((aligned(8)));
+
+class EventIndex {
+public:
+  EventIndex() = default;
+
+  // Scan data file 'datafile' and fill the index from its event headers.
+  // Only the headers are read. In blocked files, the offsets are those of
+  // the events within their blocks. Compressed files cannot be indexed.
+  // Returns 0 on success.
+  int Build( const std::string& datafile );
+
+  // Read index file 'idxfile'. If data_size is nonzero, the index must
+  // describe a data file of exactly this size, otherwise it is considered
+  // stale and rejected. Returns 0 on success, 1 if the file cannot be
+  // opened, 2 if it is invalid or stale.
+  int Read( const std::string& idxfile, uint64_t data_size = 0 );
+
+  // Write index to 'idxfile'. Returns 0 on success.
+  int Write( const std::string& idxfile ) const;
+
+  void Clear() { m_entries.clear(); m_file_size = 0; }
+
+  [[nodiscard]] bool   IsEmpty()     const { return m_entries.empty(); }
+  [[nodiscard]] size_t GetNevents()  const { return m_entries.size(); }
+  [[nodiscard]] uint64_t GetFileSize() const { return m_file_size; }
+
+  // Entry for event number 'evnum'. Event numbers start at 1.
+  [[nodiscard]] const IndexEntry& GetEntry( size_t evnum ) const {
+    return m_entries[evnum-1];
+  }
+
+  // Numbers of all events with the sync flag set
+  [[nodiscard]] std::vector<size_t> GetSyncEvents() const;
+
+  // Default index file name for data file 'datafile'
+  static std::string DefaultName( const std::string& datafile ) {
+    return datafile + ".idx";
+  }
+
+private:
+  std::vector<IndexEntry> m_entries;
+  uint64_t m_file_size{0};
+};
+
+#endif
@@ -1,8 +1,11 @@
 #include "ThreadPool.hpp"
+#include <atomic>
 #include <iostream>
 #include <iomanip>
 #include <chrono>
 #include <random>
+#include <stdexcept>
+#include <string>
 #include <thread>
 
 using namespace std;
@@ -67,6 +70,49 @@ private:
   ConcurrentQueue<Data_t>& fFreeQueue;
 };
 
+// Run groups of tasks of which some throw. wait() must return once all
+// tasks have finished and rethrow one of the exceptions. The pool must
+// remain usable afterwards. Returns the number of failed checks.
+static int TestTaskExceptions()
+{
+  const size_t NTASKS = 64;
+  int nfail = 0;
+  TaskPool pool(4);
+  for( int round = 0; round < 100; ++round ) {
+    const bool do_throw = (round % 2 == 0);
+    atomic<size_t> ndone{0};
+    TaskGroup tasks(pool);
+    for( size_t i = 0; i < NTASKS; ++i ) {
+      tasks.run([&ndone, i, do_throw] {
+        std::this_thread::sleep_for(std::chrono::microseconds(intRand(0,10)));
+        ++ndone;
+        if( do_throw && i % 10 == 3 )
+          throw runtime_error("task " + to_string(i) + " failed");
+      });
+    }
+    bool caught = false;
+    try {
+      tasks.wait();
+    }
+    catch( const runtime_error& ) {
+      caught = true;
+    }
+    if( caught != do_throw || ndone != NTASKS ) {
+      cout << "Round " << round << ": " << (caught ? "" : "no ")
+           << "exception, " << ndone << " of " << NTASKS
+           << " tasks done" << endl;
+      ++nfail;
+    }
+    // The exception is reported once
+    tasks.wait();
+  }
+  {
+    // Without wait(), the destructor waits and does not throw
+    TaskGroup tasks(pool);
+    tasks.run([] { throw runtime_error("not waited for"); });
+  }
+  return nfail;
+}
 
 int main( int /* argc */, const char*[] /* argv */ )
 {
@@ -104,5 +150,9 @@ int main( int /* argc */, const char*[] /* argv */ )
   pool.push_result(nullptr);  // Terminate output thread
   outp.join();
 
+  if( int nfail = TestTaskExceptions(); nfail != 0 ) {
+    cout << nfail << " task exception checks failed" << endl;
+    return 1;
+  }
   return 0;
 }
@@ -0,0 +1,117 @@
+// Sequence of data files read as one logical stream of events
+
+#include "FileChain.h"
+
+using namespace std;
+
+FileChain::FileChain( vector<string> filenames, DataFile::EReadMode mode,
+                      size_t blocksize, unsigned int nthreads )
+  : m_names{std::move(filenames)}
+  , m_mode{mode}
+  , m_blocksize{blocksize}
+  , m_nthreads{nthreads}
+  , m_cur{0}
+  , m_file_first{1}
+  , m_next{1}
+{
+  if( m_names.empty() )
+    m_names.emplace_back();
+  for( const auto& name : m_names ) {
+    m_files.push_back( make_unique<DataFile>(name, m_mode) );
+    m_files.back()->SetBlockSize(m_blocksize);
+    m_files.back()->SetNThreads(m_nthreads);
+  }
+}
+
+int FileChain::Open()
+{
+  m_next = 1;
+  return OpenFile(0);
+}
+
+int FileChain::OpenFile( size_t i )
+{
+  // Make file 'i' the current file, positioned at its beginning.
+  // Mapped files stay open since their events may still be in use.
+
+  if( i != m_cur && !cur()->IsMapped() )
+    cur()->Close();
+  m_cur = i;
+  m_file_first = m_next;
+  if( cur()->IsOpen() )
+    return cur()->SeekEvent(1);
+  return cur()->Open();
+}
+
+int FileChain::Close()
+{
+  for( auto& f : m_files )
+    f->Close();
+  return 0;
+}
+
+int FileChain::ReadEvent()
+{
+  if( int status; !IsOpen() && (status = Open()) != 0 )
+    return status;
+
+  for( ;; ) {
+    int status = cur()->ReadEvent();
+    if( status == 0 ) {
+      ++m_next;
+      return 0;
+    }
+    if( status != -1 || m_cur+1 == m_files.size() )
+      return status;
+    if( (status = OpenFile(m_cur+1)) != 0 )
+      return status;
+  }
+}
+
+int FileChain::LoadIndex()
+{
+  int ret = 0;
+  for( auto& f : m_files ) {
+    if( !f->HasIndex() && f->LoadIndex() != 0 )
+      ret = 1;
+  }
+  return ret;
+}
+
+int FileChain::SeekEvent( size_t evnum )
+{
+  if( evnum == 0 )
+    evnum = 1;
+  if( int status = Open(); status != 0 )
+    return status;
+
+  while( m_next < evnum ) {
+    if( cur()->HasIndex() ) {
+      size_t nev = cur()->GetIndex()->GetNevents();
+      if( evnum <= m_file_first + nev ) {
+        if( int status = cur()->SeekEvent(evnum - m_file_first + 1);
+            status != 0 )
+          return status;
+        m_next = evnum;
+        break;
+      }
+      // Skip the entire file
+      m_next = m_file_first + nev;
+      if( m_cur+1 == m_files.size() )
+        return -1;
+      if( int status = OpenFile(m_cur+1); status != 0 )
+        return status;
+    } else if( int status = ReadEvent(); status != 0 ) {
+      return status;
+    }
+  }
+  return 0;
+}
+
+IOStats FileChain::GetIOStats() const
+{
+  IOStats stats;
+  for( const auto& f : m_files )
+    stats += f->GetIOStats();
+  return stats;
+}
@@ -0,0 +1,65 @@
+// Sequence of data files read as one logical stream of events
+//
+// The files of a run split into segments are read one after the other.
+// Events are numbered globally, i.e. the first event of the second file
+// follows the last event of the first file. The interface mirrors that
+// of DataFile.
+
+#ifndef PPODD_FILECHAIN
+#define PPODD_FILECHAIN
+
+#include "DataFile.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+class FileChain {
+public:
+  explicit FileChain( std::vector<std::string> filenames,
+                      DataFile::EReadMode mode = DataFile::kStdio,
+                      size_t blocksize = ReadAhead::DEFAULT_BLOCKSIZE,
+                      unsigned int nthreads = 0 );
+
+  [[nodiscard]] bool IsOpen()   const { return cur() && cur()->IsOpen(); }
+  [[nodiscard]] bool IsMapped() const { return cur() && cur()->IsMapped(); }
+  // Open the first file
+  int       Open();
+  // Read the next event, moving on to the next file at the end of a file
+  int       ReadEvent();
+  int       Close();
+
+  // Load the event indices of all files. Returns 0 if all were loaded.
+  int       LoadIndex();
+  // Position such that the next ReadEvent() returns global event number
+  // 'evnum' (counting from 1). Whole files are skipped if their index is
+  // available. Return values as for DataFile::SeekEvent.
+  int       SeekEvent( size_t evnum );
+
+  // Current event and event buffer, see DataFile. Events read from mapped
+  // files remain valid until the chain is closed.
+  [[nodiscard]] const evbuf_t* GetEvBufPtr() const { return cur()->GetEvBufPtr(); }
+  [[nodiscard]] evbuf_ptr_t&   GetEvBuffer()       { return cur()->GetEvBuffer(); }
+  [[nodiscard]] evbuf_t        GetEvSize()   const { return cur()->GetEvSize(); }
+
+  // Statistics summed over all files read
+  [[nodiscard]] IOStats GetIOStats() const;
+
+  [[nodiscard]] size_t GetNfiles() const { return m_files.size(); }
+  // Name of the file currently being read
+  [[nodiscard]] const std::string& GetFileName() const { return m_names[m_cur]; }
+
+private:
+  std::vector<std::string> m_names;
+  std::vector<std::unique_ptr<DataFile>> m_files;
+  DataFile::EReadMode m_mode;
+  size_t   m_blocksize;
+  unsigned int m_nthreads; // Decompression threads per file
+  size_t   m_cur;         // Index of current file
+  size_t   m_file_first;  // Global number of the first event of current file
+  size_t   m_next;        // Global number of the next event to be read
+
+  [[nodiscard]] DataFile* cur() const { return m_files[m_cur].get(); }
+  int       OpenFile( size_t i );
+};
+
+#endif
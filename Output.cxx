@@ -2,45 +2,99 @@
 
 #include "Output.h"
 #include "Variable.h"
+#include "Util.h"
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <boost/algorithm/string/trim.hpp>
 
 using namespace std;
+using namespace boost::algorithm;
 
-const string& PlainVariable::GetName() const
+static constexpr char INT_TYPE = sizeof(int);
+static constexpr char DOUBLE_TYPE = (2<<5)+sizeof(double);
+
+const string& OutputSchema::Column::GetName() const
 {
-  static const string nullstr;
-  if( !fVar ) return nullstr;
-  return fVar->GetName();
+  static const string evname = "Event";
+  return var ? var->name : evname;
 }
 
+void OutputSchema::AddColumn( const VarInfo* var, char type )
+{
+  m_columns.push_back({ var, type, m_rowsize });
+  m_rowsize += type & 0x1F;
+}
 
-ostrm_t& PlainVariable::write( ostrm_t& os, bool headerinfo ) const
+shared_ptr<const OutputSchema> OutputSchema::Compile( const string& filename,
+                                                      const VarList& vars )
 {
-  if( headerinfo ) {
-    os.write( GetName().c_str(), GetName().size()+1 );
-  } else {
-    double x = fVar->GetValue();
-    os.write( reinterpret_cast<const char*>(&x), sizeof(x) );
+  if( filename.empty() )
+    return nullptr;
+
+  ifstream inp(filename);
+  if( !inp ) {
+    cerr << "Error opening output definition file " << filename << endl;
+    return nullptr;
   }
-  return os;
-}
 
-const string EventNumberVariable::fName = "Event";
+  auto schema = make_shared<OutputSchema>();
+  schema->AddColumn(nullptr, INT_TYPE);
+  string line;
+  while( getline(inp,line) ) {
+    // Wildcard match variable names, ignoring trailing comments
+    if( string::size_type pos = line.find('#'); pos != string::npos )
+      line.erase(pos);
+    trim(line);
+    if( line.empty() )
+      continue;
+    for( const auto* var : vars.Match(line) )
+      schema->AddColumn(&var->GetInfo(), DOUBLE_TYPE);
+  }
+  return schema;
+}
 
-ostrm_t& EventNumberVariable::write( ostrm_t& os, bool headerinfo ) const
+bool OutputSchema::Bind( const VarList& vars, vector<const double*>& locs ) const
 {
-  if( headerinfo ) {
-    os.write( GetName().c_str(), GetName().size()+1 );
-  } else {
-    os.write( reinterpret_cast<const char*>(&fNev), sizeof(fNev) );
+  locs.assign(m_columns.size(), nullptr);
+  for( size_t j = 0; j < m_columns.size(); ++j ) {
+    if( const auto* info = m_columns[j].var ) {
+      const auto* var = vars.Find(info->name);
+      if( !var ) {
+        cerr << "Output variable " << info->name << " not defined" << endl;
+        return false;
+      }
+      locs[j] = var->GetLocation();
+    }
   }
-  return os;
+  return true;
 }
 
-#if 0
-void Output::Print() const
+void WriteHeader( ostrm_t& os, const OutputSchema& schema )
 {
-  for( vvec_t::const_iterator it = vars.begin(); it != vars.end(); ++it ) {
-    (*it)->Print();
+  uint32_t nvars = schema.size();
+  os.write( reinterpret_cast<const char*>(&nvars), sizeof(nvars) );
+  for( const auto& col : schema.GetColumns() )
+    os.write( &col.type, sizeof(col.type) );
+  for( const auto& col : schema.GetColumns() )
+    os.write( col.GetName().c_str(), col.GetName().size()+1 );
+}
+
+void AppendRows( vector<char>& buf, const OutputSchema& schema,
+                 const char* rows, size_t nrows, size_t stride )
+{
+  const size_t rowsize = schema.GetRowSize();
+  if( stride == rowsize ) {
+    buf.insert( buf.end(), rows, rows + nrows * rowsize );
+    return;
   }
+  // Drop the data following the records
+  buf.reserve( buf.size() + nrows * rowsize );
+  for( size_t i = 0; i < nrows; ++i )
+    buf.insert( buf.end(), rows + i*stride, rows + i*stride + rowsize );
+}
+
+void WriteChunk( ostrm_t& os, const OutputChunk& chunk )
+{
+  os.write( chunk.data.data(), streamsize(chunk.data.size()) );
 }
-#endif
@@ -1,5 +1,5 @@
 // Output definition module for simple analyzer
-// Output is CSV format, optionally gzip-compressed
+// Output is CSV format, optionally gzip- or zstd-compressed
 
 #ifndef PPODD_OUTPUT
 #define PPODD_OUTPUT
@@ -12,41 +12,66 @@
 
 using ostrm_t = boost::iostreams::filtering_ostream;
 
-class OutputElement {
+struct VarInfo;
+
+// Output definitions compiled from an odef file. The schema is immutable
+// and shared by all contexts. Column 0 is the event number, followed by
+// the analysis variables matching the odef patterns, in order.
+class OutputSchema {
 public:
-  OutputElement() = default;
-  virtual ~OutputElement() = default;
+  struct Column {
+    const VarInfo* var;     // Variable ID, nullptr for the event number
+    char           type;    // See WriteHeader
+    size_t         offset;  // Position in a written row (bytes)
+    [[nodiscard]] const std::string& GetName() const;
+  };
 
-  [[nodiscard]] virtual const std::string& GetName() const = 0;
-  [[nodiscard]] virtual char GetType() const = 0;
-  virtual ostrm_t& write( ostrm_t& os, bool headerinfo ) const = 0;
-};
+  // Read the odef file 'filename' and match its wildcard patterns against
+  // the variables 'vars'. Returns nullptr on error.
+  static std::shared_ptr<const OutputSchema>
+  Compile( const std::string& filename, const VarList& vars );
 
-class PlainVariable : public OutputElement {
-public:
-  explicit PlainVariable( Variable* var ) : fVar(var) {}
+  // Put the locations of the values of the columns' variables in 'vars'
+  // into 'locs', nullptr for the event number. Returns false if 'vars'
+  // lacks any of them.
+  bool Bind( const VarList& vars, std::vector<const double*>& locs ) const;
 
-  [[nodiscard]] const std::string& GetName() const override;
-  [[nodiscard]] char GetType() const override { return (2<<5)+sizeof(double); }
-  ostrm_t& write( ostrm_t& os, bool headerinfo ) const override;
+  [[nodiscard]] const std::vector<Column>& GetColumns() const { return m_columns; }
+  [[nodiscard]] size_t size() const { return m_columns.size(); }
+  // Size of one written row (bytes)
+  [[nodiscard]] size_t GetRowSize() const { return m_rowsize; }
 
 private:
-  Variable* fVar;
-};
+  std::vector<Column> m_columns;
+  size_t m_rowsize{0};
 
-class EventNumberVariable : public OutputElement {
-public:
-  explicit EventNumberVariable( const int& nev ) : fNev(nev) {}
+  void AddColumn( const VarInfo* var, char type );
+};
 
-  [[nodiscard]] const std::string& GetName() const override { return fName; }
-  [[nodiscard]] char GetType() const override { return sizeof(int); }
-  ostrm_t& write( ostrm_t& os, bool headerinfo ) const override;
+// Write the output file header for the columns of 'schema':
+// <N = number of variables> N*<variable type> N*<variable name C-string>
+// where
+//  <variable type> = TTTNNNNN,
+// with
+//  TTT   = type (0=int, 1=unsigned, 2=float/double, 3=C-string)
+//  NNNNN = number of bytes
+void WriteHeader( ostrm_t& os, const OutputSchema& schema );
 
-private:
-  static const std::string fName;
-  const int& fNev;
+// Output records of a batch of events. The analysis threads serialize
+// their results into chunks, so that the output stage only appends bytes.
+struct OutputChunk {
+  std::vector<char>   data;    // Records, laid out as given by the schema
+  std::vector<size_t> evnum;   // Event numbers of the records
+  size_t              iseq{};  // Batch sequence number
 };
 
-using voutp_t = std::vector<std::unique_ptr<OutputElement>>;
+// Append to 'buf' the records of 'nrows' rows of results, spaced 'stride'
+// bytes apart, each starting with a record laid out as given by 'schema'
+// (see ResultRows)
+void AppendRows( std::vector<char>& buf, const OutputSchema& schema,
+                 const char* rows, size_t nrows, size_t stride );
+
+// Write the records in 'chunk'
+void WriteChunk( ostrm_t& os, const OutputChunk& chunk );
 
 #endif
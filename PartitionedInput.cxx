@@ -0,0 +1,146 @@
+// Partitioned parallel reading of indexed data files
+
+#include "PartitionedInput.h"
+#include "Podd.h"
+#include <iostream>
+#include <algorithm>
+
+using namespace std;
+
+PartitionedInput::PartitionedInput( vector<string> filenames,
+                                    DataFile::EReadMode mode,
+                                    size_t first, size_t nmax, size_t chunk )
+  // The cursors already read ahead in parallel. Block read-ahead would only
+  // read far past the end of short chunks.
+  : m_mode{mode == DataFile::kPrefetch ? DataFile::kStdio : mode}
+  , m_first{first > 0 ? first : 1}
+  , m_last{m_first}
+  , m_nmax{nmax}
+  , m_chunk{chunk}
+  , m_nchunks{0}
+  , m_next_chunk{0}
+{
+  for( auto& name : filenames )
+    m_files.push_back( {std::move(name), nullptr, 0, 0, 0, 0, 0} );
+}
+
+int PartitionedInput::Init()
+{
+  // Index all files and lay out the chunks
+
+  size_t nev = 0;
+  for( auto& file : m_files ) {
+    DataFile inp(file.name, m_mode);
+    if( int status = inp.LoadIndex(); status != 0 ) {
+      if( debug > 0 )
+        cout << "No event index for " << file.name
+             << ", scanning event headers" << endl;
+      auto idx = make_shared<EventIndex>();
+      if( idx->Build(file.name) != 0 )
+        return 1;
+      inp.SetIndex(std::move(idx));
+    }
+    file.index = inp.GetIndex();
+    file.first = nev + 1;
+    nev += file.index->GetNevents();
+  }
+  m_last = max(m_first, min(nev+1, m_first + min(m_nmax, nev)));
+
+  m_nchunks = 0;
+  for( auto& file : m_files ) {
+    file.lo = max(file.first, m_first);
+    file.hi = min(file.first + file.index->GetNevents(), m_last);
+    file.nchunks = 0;
+    if( file.hi > file.lo )
+      file.nchunks = (m_chunk > 0) ? (file.hi - file.lo + m_chunk - 1) / m_chunk : 1;
+    file.chunk0 = m_nchunks;
+    m_nchunks += file.nchunks;
+  }
+  m_next_chunk = 0;
+  return 0;
+}
+
+bool PartitionedInput::NextChunk( size_t& ifile, size_t& first, size_t& n )
+{
+  size_t ichunk = m_next_chunk.fetch_add(1);
+  if( ichunk >= m_nchunks )
+    return false;
+  // Find the file holding this chunk: the last file starting at or before
+  // it that has any chunks at all
+  auto it = upper_bound( m_files.begin(), m_files.end(), ichunk,
+                         []( size_t k, const FileInfo& f ) { return k < f.chunk0; } );
+  while( (--it)->nchunks == 0 ) {}
+  ifile = it - m_files.begin();
+  if( m_chunk > 0 ) {
+    first = it->lo + (ichunk - it->chunk0) * m_chunk;
+    n = min(m_chunk, it->hi - first);
+  } else {
+    first = it->lo;
+    n = it->hi - it->lo;
+  }
+  return true;
+}
+
+PartitionedInput::Cursor::Cursor( PartitionedInput& input )
+  : m_input{input}
+  , m_ifile{0}
+  , m_nfile{0}
+  , m_next{0}
+  , m_left{0}
+  , m_evnum{0}
+  , m_seek{true}
+{
+  NextChunk();
+}
+
+void PartitionedInput::Cursor::NextChunk()
+{
+  size_t ifile = 0, first = 0, n = 0;
+  if( !m_input.NextChunk(ifile, first, n) ) {
+    m_left = 0;
+    return;
+  }
+  // Consecutive chunks can be read without repositioning the file
+  m_seek = m_seek || (ifile != m_nfile) || (first != m_next);
+  m_nfile = ifile;
+  m_next = first;
+  m_left = n;
+}
+
+int PartitionedInput::Cursor::ReadEvent()
+{
+  if( m_left == 0 )
+    return -1;
+  const auto& file = m_input.m_files[m_nfile];
+  if( !m_file || m_ifile != m_nfile ) {
+    // Switch to the file of the current chunk. The event data of the
+    // previous file are no longer in use at this point.
+    if( m_file )
+      m_stats += m_file->GetIOStats();
+    m_file = make_unique<DataFile>(file.name, m_input.m_mode);
+    // The cursors already decompress in parallel
+    m_file->SetNThreads(1);
+    m_file->SetIndex(file.index);
+    m_ifile = m_nfile;
+    m_seek = true;
+  }
+  if( m_seek ) {
+    if( int status = m_file->SeekEvent(m_next - file.first + 1); status != 0 )
+      return status;
+    m_seek = false;
+  }
+  if( int status = m_file->ReadEvent(); status != 0 )
+    return status;
+  m_evnum = m_next++;
+  if( --m_left == 0 )
+    NextChunk();
+  return 0;
+}
+
+IOStats PartitionedInput::Cursor::GetIOStats() const
+{
+  IOStats stats = m_stats;
+  if( m_file )
+    stats += m_file->GetIOStats();
+  return stats;
+}
@@ -0,0 +1,98 @@
+// Partitioned parallel reading of indexed data files
+//
+// The range of events to be processed is split into chunks of consecutive
+// events. The chunks are handed out in file order, one at a time, to any
+// number of Cursors. Each Cursor reads its chunks with its own DataFile,
+// positioned via the event index, so that several threads can read, decode
+// and analyze disjoint parts of the same file concurrently. Event numbers
+// are taken from the index and are therefore globally correct.
+//
+// Several input files are treated as one stream of events, numbered
+// consecutively across files. Chunks never span files. With a chunk size
+// of 0, each file is one chunk, so that whole files are processed
+// concurrently, each by a single reader.
+
+#ifndef PPODD_PARTITIONEDINPUT
+#define PPODD_PARTITIONEDINPUT
+
+#include "DataFile.h"
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+class PartitionedInput {
+public:
+  // Process at most 'nmax' events starting at global event number 'first',
+  // in chunks of 'chunk' events (0 = one chunk per file)
+  PartitionedInput( std::vector<std::string> filenames, DataFile::EReadMode mode,
+                    size_t first, size_t nmax, size_t chunk );
+
+  // Load the event indices. If there is no usable index file, build the
+  // index in memory by scanning the event headers. Returns 0 on success.
+  int Init();
+
+  // Get the next chunk of events, in file 'ifile'. Thread-safe.
+  // Returns false if all chunks have been handed out.
+  bool NextChunk( size_t& ifile, size_t& first, size_t& n );
+
+  [[nodiscard]] size_t GetNevents() const { return m_last - m_first; }
+  [[nodiscard]] size_t GetFirst()   const { return m_first; }
+
+  // Reader for a sequence of chunks. Not thread-safe; use one per thread.
+  class Cursor {
+  public:
+    explicit Cursor( PartitionedInput& input );
+
+    // Read the next event of this cursor's current chunk. Moves on to the
+    // next available chunk once the current one is exhausted.
+    // Returns 0 on success, -1 if there are no more events, > 0 on error.
+    int ReadEvent();
+
+    // True if ReadEvent() will return another event
+    [[nodiscard]] bool   HasNext()      const { return m_left > 0; }
+    // True if the next ReadEvent() reads from the file that is open now
+    [[nodiscard]] bool   NextInSameFile() const { return m_file && m_nfile == m_ifile; }
+    // Number of the event that the next ReadEvent() will return
+    [[nodiscard]] size_t GetNextEvnum() const { return m_next; }
+    // Number of the event last read
+    [[nodiscard]] size_t GetEvnum()     const { return m_evnum; }
+    [[nodiscard]] DataFile& GetFile()         { return *m_file; }
+    // Statistics summed over all files read
+    [[nodiscard]] IOStats GetIOStats() const;
+
+  private:
+    PartitionedInput& m_input;
+    std::unique_ptr<DataFile> m_file;
+    size_t   m_ifile;  // Index of the file open in m_file
+    size_t   m_nfile;  // Index of the file of the current chunk
+    size_t   m_next;   // Next event number to read
+    size_t   m_left;   // Events remaining in the current chunk
+    size_t   m_evnum;  // Event number of the current event
+    bool     m_seek;   // Must seek before reading m_next
+    IOStats  m_stats;  // Statistics of files no longer open
+
+    void     NextChunk();
+  };
+
+private:
+  struct FileInfo {
+    std::string name;
+    std::shared_ptr<const EventIndex> index;
+    size_t first;      // Global number of the first event in this file
+    size_t lo, hi;     // Range of global event numbers to process
+    size_t nchunks;    // Number of chunks in this file
+    size_t chunk0;     // Global number of this file's first chunk
+  };
+
+  std::vector<FileInfo> m_files;
+  DataFile::EReadMode m_mode;
+  size_t m_first;      // First event number to process
+  size_t m_last;       // One past the last event number to process
+  size_t m_nmax;       // Maximum number of events requested
+  size_t m_chunk;      // Events per chunk (0 = whole files)
+  size_t m_nchunks;    // Total number of chunks
+  std::atomic<size_t> m_next_chunk;
+};
+
+#endif
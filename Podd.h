@@ -3,8 +3,8 @@
 #ifndef PPODD_H
 #define PPODD_H
 
+#include "DataFile.h"  // for DataFile::EReadMode
 #include <vector>
-#include <list>
 #include <memory>
 #include <string>
 #include <limits>
@@ -12,8 +12,9 @@
 
 // Typedefs for variable and detector lists
 class Variable;
+class VarList;
 class Detector;
-using varlst_t = std::list<std::unique_ptr<Variable>>;
+using varlst_t = VarList;
 using detlst_t = std::vector<std::unique_ptr<Detector>>;
 using ClockTime_t  = std::chrono::duration<double, std::milli>;
 
@@ -23,16 +24,37 @@ extern int debug;
 // Program configuration
 struct Config {
   Config() noexcept
-    : nev_max(std::numeric_limits<size_t>::max())
+    : first_event(1)
+    , nev_max(std::numeric_limits<size_t>::max())
     , nthreads(0)
     , mark(0)
+    , nev_chunk(0)
+    , parallel_files(false)
+    , batch_size(16)
+    , task_threshold(-1)
+    , read_mode(DataFile::kStdio)
+    , read_block_size(ReadAhead::DEFAULT_BLOCKSIZE)
+    , io_threads(0)
   {}
   void default_names();
 
   std::string input_file, odef_file, output_file, db_file;
+  std::string det_file;  // Detector list, empty = default detectors
+  std::vector<std::string> input_files;  // All input files, read in order
+  size_t first_event;
   size_t nev_max;
   unsigned int nthreads;
   unsigned int mark;
+  size_t nev_chunk;   // Events per chunk for partitioned input (0 = off)
+  bool parallel_files; // Process input files concurrently
+  size_t batch_size;   // Events analyzed together per context
+  double task_threshold; // Min. cost (us/batch) of detectors run as
+                         // concurrent tasks, < 0 = off
+  DataFile::EReadMode read_mode;
+  size_t read_block_size;  // Block size (bytes) for kPrefetch
+  unsigned int io_threads; // Decompression threads per input stream and
+                           // compression threads for the output, derived
+                           // from nthreads (0 = default of ReadAhead etc.)
 } __attribute__((aligned(128)));
 
 extern Config cfg;
@@ -57,6 +79,16 @@ int DefineVarsFromList( const std::vector<VarDef_t>& defs,
 
 void PrintVarList( const std::shared_ptr<varlst_t>& varlst );
 
+// Create the detectors listed in file 'filename' and append them to
+// 'dets'. Each line of the file reads
+//   type name module_number [arguments...]
+// An empty 'filename' gives the default set of detectors. Returns 0 on
+// success.
+int MakeDetectors( const std::string& filename, detlst_t& dets );
+
+// Print the counters of the result caches of the detectors in 'dets'
+void PrintCacheStats( const detlst_t& dets );
+
 #define ALL(c) (c).begin(), (c).end()
 
 #endif
@@ -0,0 +1,111 @@
+// Writer for raw data files
+
+#include "RawWriter.h"
+#include "Crc32c.h"
+#include "rawdata.h"
+#include <cstring>
+#include <iostream>
+#include <limits>
+
+using namespace std;
+
+RawWriter::RawWriter( size_t block_events )
+  : m_file{nullptr}
+  , m_block_events{block_events}
+  , m_nblock{0}
+  , m_nevents{0}
+  , m_nblocks{0}
+{}
+
+RawWriter::~RawWriter()
+{
+  Close();
+}
+
+int RawWriter::Open( const string& filename )
+{
+  Close();
+  m_filename = filename;
+  m_file = fopen( m_filename.c_str(), "wb" );
+  if( !m_file ) {
+    cerr << "Cannot open file " << m_filename << endl;
+    return 1;
+  }
+  m_nblock = 0;
+  m_nevents = m_nblocks = 0;
+  m_block.clear();
+  if( m_block_events == 0 )
+    return 0;
+
+  RawFileHeader hdr{};
+  memcpy( hdr.magic, RAWFILE_MAGIC, sizeof(RAWFILE_MAGIC) );
+  hdr.version = RAWFILE_VERSION;
+  hdr.header_size = sizeof(hdr);
+  hdr.block_events = m_block_events;
+  return Write( &hdr, sizeof(hdr) );
+}
+
+int RawWriter::Write( const void* data, size_t len )
+{
+  if( fwrite( data, 1, len, m_file ) != len ) {
+    cerr << "Error writing file " << m_filename << endl;
+    return 2;
+  }
+  return 0;
+}
+
+int RawWriter::WriteEvent( const void* event, size_t len )
+{
+  if( !m_file )
+    return 1;
+  if( m_block_events == 0 ) {
+    if( int status = Write( event, len ); status != 0 )
+      return status;
+    ++m_nevents;
+    return 0;
+  }
+  // Blocks must fit the 32-bit length field
+  if( m_nblock > 0 &&
+      m_block.size() + len > numeric_limits<uint32_t>::max() ) {
+    if( int status = FlushBlock(); status != 0 )
+      return status;
+  }
+  const auto* p = static_cast<const char*>(event);
+  m_block.insert( m_block.end(), p, p + len );
+  ++m_nevents;
+  if( ++m_nblock == m_block_events )
+    return FlushBlock();
+  return 0;
+}
+
+int RawWriter::FlushBlock()
+{
+  if( m_nblock == 0 )
+    return 0;
+  RawBlockHeader hdr{};
+  hdr.magic = RAWBLOCK_MAGIC;
+  hdr.nevents = m_nblock;
+  hdr.first_event = m_nevents - m_nblock + 1;
+  hdr.length = m_block.size();
+  hdr.crc = Crc32c( m_block.data(), m_block.size() );
+  int status = Write( &hdr, sizeof(hdr) );
+  if( status == 0 )
+    status = Write( m_block.data(), m_block.size() );
+  m_block.clear();
+  m_nblock = 0;
+  ++m_nblocks;
+  return status;
+}
+
+int RawWriter::Close()
+{
+  if( !m_file )
+    return 0;
+  int ret = FlushBlock();
+  if( fclose(m_file) != 0 && ret == 0 ) {
+    cerr << "Error writing file " << m_filename << endl;
+    ret = 2;
+  }
+  m_file = nullptr;
+  return ret;
+}
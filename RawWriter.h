@@ -0,0 +1,47 @@
+// Writer for raw data files
+//
+// Writes either blocked (version 2) files, see rawdata.h, or plain
+// version 1 streams of events.
+
+#ifndef PPODD_RAWWRITER
+#define PPODD_RAWWRITER
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+class RawWriter {
+public:
+  static constexpr size_t DEFAULT_BLOCK_EVENTS = 1000;
+
+  // Collect 'block_events' events per block. 0 = write a version 1 file
+  explicit RawWriter( size_t block_events = DEFAULT_BLOCK_EVENTS );
+  ~RawWriter();
+
+  // Create 'filename' and write the file header. Returns 0 on success.
+  int  Open( const std::string& filename );
+  // Append event of 'len' bytes. Returns 0 on success.
+  int  WriteEvent( const void* event, size_t len );
+  // Write the last, possibly partial, block and close the file.
+  // Returns 0 on success.
+  int  Close();
+
+  [[nodiscard]] bool     IsOpen()     const { return m_file != nullptr; }
+  [[nodiscard]] uint64_t GetNevents() const { return m_nevents; }
+  [[nodiscard]] uint64_t GetNblocks() const { return m_nblocks; }
+
+private:
+  std::string       m_filename;
+  FILE*             m_file;
+  size_t            m_block_events;
+  std::vector<char> m_block;    // Event data of the block being filled
+  uint32_t          m_nblock;   // Number of events in m_block
+  uint64_t          m_nevents;  // Number of events written
+  uint64_t          m_nblocks;  // Number of blocks written
+
+  int  Write( const void* data, size_t len );
+  int  FlushBlock();
+};
+
+#endif
@@ -0,0 +1,638 @@
+// Asynchronous read-ahead of a file in large blocks
+
+#include "ReadAhead.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/filter/zstd.hpp>
+#include <boost/iostreams/device/array.hpp>
+
+using namespace std;
+namespace io = boost::iostreams;
+using Clock = chrono::steady_clock;
+
+static constexpr size_t npos = string::npos;
+static constexpr uint32_t ZSTD_MAGIC = 0xFD2FB528;
+static constexpr uint32_t ZSTD_SKIPPABLE_MAGIC = 0x184D2A50; // Low 4 bits free
+
+static inline uint32_t le16( const unsigned char* p ) {
+  return p[0] | (uint32_t(p[1]) << 8);
+}
+static inline uint32_t le32( const unsigned char* p ) {
+  return le16(p) | (le16(p+2) << 16);
+}
+
+// Compression format of data starting with the 'n' bytes at 'p'
+static ReadAhead::ECompression Compression( const unsigned char* p, size_t n )
+{
+  if( n >= 3 && p[0] == 0x1f && p[1] == 0x8b && p[2] == 8 )
+    return ReadAhead::kGzip;
+  if( n >= 4 && (le32(p) == ZSTD_MAGIC ||
+                 (le32(p) & 0xFFFFFFF0) == ZSTD_SKIPPABLE_MAGIC) )
+    return ReadAhead::kZstd;
+  return ReadAhead::kNone;
+}
+
+// Total size of the BGZF block (gzip member) at 'p', 0 if more than 'n'
+// bytes are needed to tell, npos if this is not a BGZF block
+static size_t BgzfBlockSize( const unsigned char* p, size_t n )
+{
+  if( n < 12 )
+    return 0;
+  if( p[0] != 0x1f || p[1] != 0x8b || p[2] != 8 || !(p[3] & 4) )
+    return npos;
+  size_t xend = 12 + le16(p+10);
+  if( n < xend )
+    return 0;
+  // The compressed size is stored in extra subfield "BC"
+  for( size_t i = 12; i + 4 <= xend; i += 4 + le16(p+i+2) ) {
+    if( p[i] == 'B' && p[i+1] == 'C' && le16(p+i+2) == 2 && i + 6 <= xend ) {
+      size_t bsize = le16(p+i+4) + 1;
+      return bsize <= n ? bsize : 0;
+    }
+  }
+  return npos;
+}
+
+// Total size of the zstd frame at 'p', 0 if more than 'n' bytes are needed
+// to tell, npos if this is not a zstd frame. Walks the block headers
+// without decompressing anything.
+static size_t ZstdFrameSize( const unsigned char* p, size_t n )
+{
+  if( n < 8 )
+    return 0;
+  uint32_t magic = le32(p);
+  if( (magic & 0xFFFFFFF0) == ZSTD_SKIPPABLE_MAGIC ) {
+    size_t sz = 8 + size_t(le32(p+4));
+    return sz <= n ? sz : 0;
+  }
+  if( magic != ZSTD_MAGIC )
+    return npos;
+  unsigned fhd = p[4];
+  unsigned fcs_flag = fhd >> 6, single_segment = (fhd >> 5) & 1;
+  unsigned checksum = (fhd >> 2) & 1, did_flag = fhd & 3;
+  size_t pos = 5 + (single_segment ? 0 : 1) + (did_flag == 3 ? 4 : did_flag)
+               + (fcs_flag == 0 ? single_segment : (1u << fcs_flag));
+  for( bool last = false; !last; ) {
+    if( pos + 3 > n )
+      return 0;
+    uint32_t bh = p[pos] | (uint32_t(p[pos+1]) << 8) | (uint32_t(p[pos+2]) << 16);
+    last = bh & 1;
+    unsigned type = (bh >> 1) & 3;
+    if( type == 3 )
+      return npos;
+    pos += 3 + (type == 1 ? 1 : (bh >> 3));  // RLE blocks hold one byte
+  }
+  pos += checksum ? 4 : 0;
+  return pos <= n ? pos : 0;
+}
+
+// Content size of the zstd frame starting with the 'n' bytes at 'p', or
+// npos if unknown
+static size_t ZstdContentSize( const unsigned char* p, size_t n )
+{
+  if( n < 5 || le32(p) != ZSTD_MAGIC )
+    return npos;
+  unsigned fhd = p[4];
+  unsigned fcs_flag = fhd >> 6, single_segment = (fhd >> 5) & 1;
+  unsigned did_flag = fhd & 3;
+  if( fcs_flag == 0 && !single_segment )
+    return npos;
+  size_t pos = 5 + (single_segment ? 0 : 1) + (did_flag == 3 ? 4 : did_flag);
+  size_t len = (fcs_flag == 0) ? 1 : (1u << fcs_flag);
+  if( pos + len > n )
+    return npos;
+  uint64_t fcs = 0;
+  for( size_t i = 0; i < len; ++i )
+    fcs |= uint64_t(p[pos+i]) << (8*i);
+  return (fcs_flag == 1) ? fcs + 256 : fcs;
+}
+
+//_____________________________________________________________________________
+// boost::iostreams source device reading the input file via ReadRaw
+struct ReadAhead::Source {
+  using char_type = char;
+  using category = io::source_tag;
+  ReadAhead* m_ra;
+  streamsize read( char* s, streamsize n ) {
+    long r = m_ra->ReadRaw(s, n);
+    if( r < 0 )
+      throw ios_base::failure(strerror(errno));
+    return (r == 0) ? -1 : r;
+  }
+};
+
+// Input stream for kStream, decompressing if necessary
+struct ReadAhead::Stream {
+  io::filtering_istream in;
+};
+
+//_____________________________________________________________________________
+ReadAhead::ReadAhead( size_t blocksize, unsigned int nthreads )
+  : m_blocksize{blocksize > 0 ? blocksize : DEFAULT_BLOCKSIZE}
+  , m_nthreads{nthreads > 0 ? nthreads
+                            : max(thread::hardware_concurrency()/2, 1u)}
+  , m_fd{-1}
+  , m_seekable{false}
+  , m_compression{kNone}
+  , m_method{kPread}
+  , m_offset{0}
+  , m_prefix_pos{0}
+  , m_input_eof{false}
+  , m_ring(NBLOCKS)
+  , m_head{0}
+  , m_filled{0}
+  , m_npending{0}
+  , m_stop{false}
+  , m_reader_done{false}
+  , m_bytes{0}
+  , m_read_time{}
+  , m_stall_time{}
+{
+  // Constructor. The block buffers are allocated by the reader thread
+  // as needed.
+}
+
+ReadAhead::~ReadAhead()
+{
+  Close();
+}
+
+ReadAhead::ECompression ReadAhead::DetectCompression( const string& filename )
+{
+  unsigned char magic[4];
+  ssize_t n = 0;
+  int fd = open( filename.c_str(), O_RDONLY );
+  if( fd < 0 )
+    return kNone;
+  struct stat st{};
+  if( fstat(fd, &st) == 0 && S_ISREG(st.st_mode) )
+    n = pread( fd, magic, sizeof(magic), 0 );
+  close(fd);
+  return Compression( magic, max(n, ssize_t(0)) );
+}
+
+int ReadAhead::Open( const string& filename )
+{
+  Close();
+  m_fd = open( filename.c_str(), O_RDONLY );
+  if( m_fd < 0 ) {
+    cerr << "Error opening file " << filename << endl;
+    return 1;
+  }
+  m_seekable = (lseek(m_fd, 0, SEEK_CUR) >= 0);
+
+  // Detect the format from the first bytes. Non-seekable input is read
+  // through m_prefix so that these bytes are not lost.
+  unsigned char magic[18];
+  size_t n = 0;
+  m_prefix.clear();
+  m_prefix_pos = 0;
+  if( m_seekable ) {
+    ssize_t r = pread( m_fd, magic, sizeof(magic), 0 );
+    n = max(r, ssize_t(0));
+  } else {
+    while( n < sizeof(magic) ) {
+      ssize_t r = read( m_fd, magic + n, sizeof(magic) - n );
+      if( r < 0 && errno == EINTR )
+        continue;
+      if( r <= 0 )
+        break;
+      n += r;
+    }
+    m_prefix.assign( magic, magic + n );
+  }
+  m_compression = Compression( magic, n );
+  switch( m_compression ) {
+    case kNone:
+      m_method = m_seekable ? kPread : kStream;
+      break;
+    case kGzip:
+      m_method = (BgzfBlockSize(magic, n) != npos) ? kFrames : kStream;
+      break;
+    case kZstd: {
+      // Parallel decompression pays off only if the file is made of many
+      // frames. Frames of unknown or large size are streamed.
+      size_t fcs = ZstdContentSize( magic, n );
+      bool skippable = (le32(magic) & 0xFFFFFFF0) == ZSTD_SKIPPABLE_MAGIC;
+      m_method = (skippable || fcs <= 4*m_blocksize) ? kFrames : kStream;
+      break;
+    }
+  }
+  if( m_seekable )
+    posix_fadvise( m_fd, 0, 0, POSIX_FADV_SEQUENTIAL );
+  m_ring.resize( m_method == kFrames ? max<size_t>(NBLOCKS, m_nthreads + 2)
+                                     : NBLOCKS );
+  m_bytes = 0;
+  m_read_time = m_stall_time = {};
+  Start(0);
+  return 0;
+}
+
+void ReadAhead::Close()
+{
+  Stop();
+  m_stream.reset();
+  if( m_fd >= 0 ) {
+    close(m_fd);
+    m_fd = -1;
+  }
+}
+
+int ReadAhead::Seek( uint64_t offset )
+{
+  if( m_fd < 0 )
+    return 1;
+  if( offset == m_offset )
+    return 0;
+  if( m_method == kPread ) {
+    Stop();
+    Start(offset);
+    return 0;
+  }
+  // Sequential or compressed input. Go forward by reading.
+  if( offset < m_offset ) {
+    if( !m_seekable )
+      return 1;
+    Stop();
+    Start(0);
+  }
+  return Skip( offset - m_offset );
+}
+
+int ReadAhead::Skip( uint64_t nbytes )
+{
+  // Read and discard 'nbytes' bytes
+
+  auto scratch = make_unique<char[]>(65536);
+  while( nbytes > 0 ) {
+    size_t len = min<uint64_t>(nbytes, 65536);
+    int status = 0;
+    if( Read(scratch.get(), len, status) != len )
+      return 1;
+    nbytes -= len;
+  }
+  return 0;
+}
+
+void ReadAhead::Start( uint64_t offset )
+{
+  // Start the reader thread at data position 'offset', and the
+  // decompression threads if needed. Unless reading with pread,
+  // 'offset' must be 0.
+
+  m_head = m_filled = m_npending = 0;
+  m_stop = m_reader_done = m_input_eof = false;
+  m_offset = offset;
+  m_carry.clear();
+  for( auto& blk : m_ring ) {
+    blk.len = blk.pos = blk.status = 0;
+    blk.state = Block::kFree;
+  }
+  if( m_method != kPread ) {
+    if( m_seekable )
+      lseek( m_fd, 0, SEEK_SET );
+    if( m_method == kStream ) {
+      m_stream = make_unique<Stream>();
+      if( m_compression == kGzip )
+        m_stream->in.push(io::gzip_decompressor());
+      else if( m_compression == kZstd )
+        m_stream->in.push(io::zstd_decompressor());
+      m_stream->in.push(Source{this});
+    }
+  }
+  m_thread = thread(&ReadAhead::Run, this, offset);
+  if( m_method == kFrames ) {
+    for( unsigned int i = 0; i < m_nthreads; ++i )
+      m_workers.emplace_back(&ReadAhead::Decompress, this);
+  }
+}
+
+void ReadAhead::Stop()
+{
+  if( !m_thread.joinable() )
+    return;
+  {
+    lock_guard lock(m_mutex);
+    m_stop = true;
+  }
+  m_not_full.notify_all();
+  m_work.notify_all();
+  m_thread.join();
+  for( auto& t : m_workers )
+    t.join();
+  m_workers.clear();
+}
+
+void ReadAhead::Run( uint64_t offset )
+{
+  // Reader thread. Fill free blocks in sequence until end of file, error,
+  // or a stop request.
+
+  uint64_t pos = offset;
+  for( ;; ) {
+    Block* blk;
+    {
+      unique_lock lock(m_mutex);
+      m_not_full.wait(lock, [this] {
+        return m_stop || m_filled < m_ring.size();
+      });
+      if( m_stop )
+        return;
+      blk = &m_ring[(m_head + m_filled) % m_ring.size()];
+    }
+
+    auto start = Clock::now();
+    int status = 0;
+    switch( m_method ) {
+      case kPread:
+        status = ReadBlock(*blk, pos);
+        break;
+      case kStream:
+        status = ReadStream(*blk);
+        break;
+      case kFrames:
+        status = ReadFrames(*blk);
+        break;
+    }
+    auto stop = Clock::now();
+
+    bool pending = (m_method == kFrames && !blk->input.empty());
+    {
+      lock_guard lock(m_mutex);
+      blk->pos = 0;
+      blk->status = status;
+      blk->state = pending ? Block::kPending : Block::kReady;
+      if( pending )
+        ++m_npending;
+      ++m_filled;
+      m_read_time += stop - start;
+      if( status != 0 )
+        m_reader_done = true;
+    }
+    if( pending )
+      m_work.notify_one();
+    else
+      m_not_empty.notify_one();
+    if( status != 0 ) {
+      m_work.notify_all();
+      return;
+    }
+  }
+}
+
+void ReadAhead::Decompress()
+{
+  // Decompression thread. Decompress pending blocks, earliest first.
+
+  for( ;; ) {
+    Block* blk = nullptr;
+    {
+      unique_lock lock(m_mutex);
+      m_work.wait(lock, [this] {
+        return m_stop || m_npending > 0 || m_reader_done;
+      });
+      if( m_stop || m_npending == 0 )
+        return;
+      for( size_t i = 0; i < m_filled; ++i ) {
+        auto& b = m_ring[(m_head + i) % m_ring.size()];
+        if( b.state == Block::kPending ) {
+          blk = &b;
+          break;
+        }
+      }
+      blk->state = Block::kBusy;
+      --m_npending;
+    }
+
+    auto start = Clock::now();
+    int status = DecompressBlock(*blk);
+    auto stop = Clock::now();
+
+    {
+      lock_guard lock(m_mutex);
+      if( status != 0 )
+        blk->status = status;
+      blk->state = Block::kReady;
+      m_read_time += stop - start;
+    }
+    m_not_empty.notify_one();
+  }
+}
+
+int ReadAhead::ReadBlock( Block& blk, uint64_t& pos )
+{
+  // Read the next block with pread
+
+  if( blk.data.size() < m_blocksize )
+    blk.data.resize(m_blocksize);
+  blk.len = 0;
+  while( blk.len < m_blocksize ) {
+    ssize_t n = pread( m_fd, blk.data.data() + blk.len, m_blocksize - blk.len,
+                       off_t(pos) );
+    if( n < 0 ) {
+      if( errno == EINTR )
+        continue;
+      return errno;
+    }
+    if( n == 0 )
+      return -1;
+    blk.len += n;
+    pos += n;
+    m_bytes += n;
+  }
+  return 0;
+}
+
+int ReadAhead::ReadStream( Block& blk )
+{
+  // Read the next block from the input stream, decompressing as needed
+
+  if( blk.data.size() < m_blocksize )
+    blk.data.resize(m_blocksize);
+  blk.len = 0;
+  try {
+    auto& in = m_stream->in;
+    in.read( blk.data.data(), streamsize(m_blocksize) );
+    blk.len = in.gcount();
+    if( in.bad() )
+      return EIO;
+    if( in.eof() )
+      return -1;
+  }
+  catch( const exception& e ) {
+    cerr << "Error reading input: " << e.what() << endl;
+    return EIO;
+  }
+  return 0;
+}
+
+long ReadAhead::ReadRaw( char* buf, size_t len )
+{
+  // Read up to 'len' bytes from the current file position. Returns the
+  // number of bytes read, 0 at end of file, -1 on error.
+
+  if( m_prefix_pos < m_prefix.size() ) {
+    size_t n = min(len, m_prefix.size() - m_prefix_pos);
+    memcpy( buf, m_prefix.data() + m_prefix_pos, n );
+    m_prefix_pos += n;
+    m_bytes += n;
+    return long(n);
+  }
+  for( ;; ) {
+    ssize_t n = read( m_fd, buf, len );
+    if( n < 0 && errno == EINTR )
+      continue;
+    if( n > 0 )
+      m_bytes += n;
+    return n;
+  }
+}
+
+size_t ReadAhead::FrameSize( const unsigned char* p, size_t n ) const
+{
+  return (m_compression == kGzip) ? BgzfBlockSize(p, n) : ZstdFrameSize(p, n);
+}
+
+int ReadAhead::ReadFrames( Block& blk )
+{
+  // Collect whole compressed frames, about half a block's worth, into the
+  // block's input buffer for decompression by a worker thread
+
+  const size_t target = m_blocksize / 2;
+  blk.len = 0;
+  blk.input.clear();
+  for( ;; ) {
+    size_t used = 0;
+    while( used < m_carry.size() && used < target ) {
+      size_t sz = FrameSize( reinterpret_cast<const unsigned char*>(
+                               m_carry.data() + used), m_carry.size() - used );
+      if( sz == npos ) {
+        cerr << "Bad compressed frame in input" << endl;
+        return EBADMSG;
+      }
+      if( sz == 0 )
+        break;
+      used += sz;
+    }
+    if( used > 0 && (used >= target || m_input_eof) ) {
+      blk.input.assign( m_carry.begin(), m_carry.begin() + long(used) );
+      m_carry.erase( m_carry.begin(), m_carry.begin() + long(used) );
+      return (m_input_eof && m_carry.empty()) ? -1 : 0;
+    }
+    if( m_input_eof ) {
+      if( m_carry.empty() )
+        return -1;
+      cerr << "Truncated compressed frame at end of input" << endl;
+      return EBADMSG;
+    }
+    size_t old = m_carry.size();
+    m_carry.resize(old + target);
+    long n = ReadRaw( m_carry.data() + old, target );
+    int err = errno;
+    m_carry.resize(old + max(n, 0L));
+    if( n < 0 )
+      return err;
+    if( n == 0 )
+      m_input_eof = true;
+  }
+}
+
+int ReadAhead::DecompressBlock( Block& blk ) const
+{
+  // Decompress the frames in blk.input into blk.data
+
+  if( blk.data.size() < m_blocksize )
+    blk.data.resize(m_blocksize);
+  blk.len = 0;
+  try {
+    io::filtering_istream in;
+    if( m_compression == kGzip )
+      in.push(io::gzip_decompressor());
+    else
+      in.push(io::zstd_decompressor());
+    in.push(io::array_source(blk.input.data(), blk.input.size()));
+    for( ;; ) {
+      if( blk.len == blk.data.size() )
+        blk.data.resize(2 * blk.data.size());
+      in.read( blk.data.data() + blk.len, streamsize(blk.data.size() - blk.len) );
+      blk.len += in.gcount();
+      if( !in )
+        break;
+    }
+    if( in.bad() )
+      return EIO;
+  }
+  catch( const exception& e ) {
+    cerr << "Error decompressing input: " << e.what() << endl;
+    return EBADMSG;
+  }
+  return 0;
+}
+
+size_t ReadAhead::Read( void* dest, size_t len, int& status )
+{
+  auto* p = static_cast<char*>(dest);
+  size_t got = 0;
+  status = 0;
+  while( got < len ) {
+    Block* blk;
+    {
+      unique_lock lock(m_mutex);
+      auto ready = [this] {
+        return m_filled > 0 && m_ring[m_head].state == Block::kReady;
+      };
+      if( !ready() ) {
+        auto start = Clock::now();
+        m_not_empty.wait(lock, ready);
+        m_stall_time += Clock::now() - start;
+      }
+      blk = &m_ring[m_head];
+    }
+    // The other threads do not touch ready blocks
+    size_t n = min(len - got, blk->len - blk->pos);
+    memcpy( p + got, blk->data.data() + blk->pos, n );
+    blk->pos += n;
+    got += n;
+    if( blk->pos == blk->len ) {
+      if( blk->status != 0 ) {
+        // Keep the last block so that further reads see the same status
+        status = blk->status;
+        break;
+      }
+      {
+        lock_guard lock(m_mutex);
+        blk->state = Block::kFree;
+        m_head = (m_head + 1) % m_ring.size();
+        --m_filled;
+      }
+      m_not_full.notify_one();
+    }
+  }
+  m_offset += got;
+  return got;
+}
+
+uint64_t ReadAhead::GetBytesRead() const
+{
+  return m_bytes;
+}
+
+ReadAhead::Duration_t ReadAhead::GetReadTime() const
+{
+  lock_guard lock(m_mutex);
+  return m_read_time;
+}
+
+ReadAhead::Duration_t ReadAhead::GetStallTime() const
+{
+  lock_guard lock(m_mutex);
+  return m_stall_time;
+}
@@ -0,0 +1,139 @@
+// Asynchronous read-ahead of a file in large blocks
+//
+// A background thread reads the file sequentially into a ring of block
+// buffers while the consumer copies data out of blocks that are already in
+// memory. The consumer only waits (stalls) if the reader thread has fallen
+// behind. Blocks are read with pread(2). Files that cannot be positioned,
+// such as pipes, are read with plain read(2).
+//
+// gzip- and zstd-compressed files are detected from their magic bytes and
+// decompressed by the reader thread. If the file consists of independently
+// decompressible pieces whose size can be determined without decompressing
+// them, namely zstd frames with known content size or BGZF blocks (gzip
+// members carrying their compressed size), the reader thread only cuts the
+// file at frame boundaries, and the blocks are decompressed in parallel by
+// a set of worker threads. The consumer still sees the data in file order.
+
+#ifndef PPODD_READAHEAD
+#define PPODD_READAHEAD
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class ReadAhead {
+public:
+  using Duration_t = std::chrono::duration<double, std::milli>;
+
+  enum ECompression { kNone, kGzip, kZstd };
+
+  static constexpr size_t DEFAULT_BLOCKSIZE = 8*1024*1024;
+  static constexpr size_t NBLOCKS = 3;   // Block being consumed + 2 ahead
+
+  // 'nthreads' is the number of threads for parallel decompression
+  // (0 = half the number of hardware threads)
+  explicit ReadAhead( size_t blocksize = DEFAULT_BLOCKSIZE,
+                      unsigned int nthreads = 0 );
+  ~ReadAhead();
+  ReadAhead( const ReadAhead& ) = delete;
+  ReadAhead& operator=( const ReadAhead& ) = delete;
+
+  // Open 'filename' and start reading at the beginning. Returns 0 on success.
+  int  Open( const std::string& filename );
+  void Close();
+  [[nodiscard]] bool IsOpen() const { return m_fd >= 0; }
+
+  [[nodiscard]] ECompression GetCompression() const { return m_compression; }
+  // True if blocks are being decompressed in parallel
+  [[nodiscard]] bool IsParallel() const { return m_method == kFrames; }
+
+  // Discard any data read ahead and continue reading at byte 'offset'
+  // of the (uncompressed) data. Compressed files are read and decompressed
+  // up to 'offset'. Returns 0 on success, 1 if the file cannot be
+  // positioned there.
+  int  Seek( uint64_t offset );
+
+  // Copy the next 'len' bytes to 'dest', waiting for the reader thread if
+  // necessary. Returns the number of bytes copied. If this is less than
+  // 'len', 'status' is -1 at end of file or the errno of a read error.
+  size_t Read( void* dest, size_t len, int& status );
+
+  // Statistics
+  [[nodiscard]] uint64_t   GetBytesRead() const;  // Bytes read from the file
+  [[nodiscard]] Duration_t GetReadTime()  const;  // Time reading/decompressing
+  [[nodiscard]] Duration_t GetStallTime() const;  // Consumer time waiting
+
+  // Compression format of the regular file 'filename', judged from its
+  // first bytes. Returns kNone for anything that cannot be read.
+  static ECompression DetectCompression( const std::string& filename );
+
+private:
+  // How blocks are produced
+  enum EMethod {
+    kPread,   // Uncompressed, seekable. pread(2) into the block
+    kStream,  // Sequential read(2), possibly decompressed by the reader
+    kFrames   // Cut into compressed frames, decompressed by workers
+  };
+
+  struct Block {
+    enum EState { kFree, kPending, kBusy, kReady };
+    std::vector<char> data;   // Data for the consumer
+    std::vector<char> input;  // Compressed frames (kFrames)
+    size_t len{0};      // Valid bytes in 'data'
+    size_t pos{0};      // Consumer position
+    int    status{0};   // 0 = more data follow, -1 = end of file, > 0 = errno
+    EState state{kFree};
+  };
+  struct Source;        // boost::iostreams source reading via ReadRaw()
+  struct Stream;        // Decompressing stream for kStream
+
+  size_t       m_blocksize;
+  unsigned int m_nthreads;
+  int          m_fd;
+  bool         m_seekable;
+  ECompression m_compression;
+  EMethod      m_method;
+  uint64_t     m_offset;   // Data position of the consumer
+  std::vector<char> m_prefix;   // Bytes consumed by format detection
+  size_t       m_prefix_pos;    //  (non-seekable input only)
+  std::unique_ptr<Stream> m_stream;
+  std::vector<char> m_carry;    // Incomplete frames (kFrames)
+  bool         m_input_eof;
+
+  std::vector<Block> m_ring;
+  size_t       m_head;     // Block currently being consumed
+  size_t       m_filled;   // Number of filled blocks, starting at m_head
+  size_t       m_npending; // Blocks waiting for decompression
+  bool         m_stop;     // Request for all threads to exit
+  bool         m_reader_done;
+  std::thread  m_thread;
+  std::vector<std::thread> m_workers;
+  mutable std::mutex m_mutex;
+  std::condition_variable m_not_empty;
+  std::condition_variable m_not_full;
+  std::condition_variable m_work;
+
+  std::atomic<uint64_t> m_bytes;
+  Duration_t   m_read_time;
+  Duration_t   m_stall_time;
+
+  void Start( uint64_t offset );
+  void Stop();
+  int  Skip( uint64_t nbytes );
+  void Run( uint64_t offset );
+  void Decompress();
+  int  ReadBlock( Block& blk, uint64_t& pos );
+  int  ReadStream( Block& blk );
+  int  ReadFrames( Block& blk );
+  int  DecompressBlock( Block& blk ) const;
+  long ReadRaw( char* buf, size_t len );
+  size_t FrameSize( const unsigned char* p, size_t n ) const;
+};
+
+#endif
@@ -0,0 +1,98 @@
+// Concurrent cache of detector results
+
+#include "ResultCache.h"
+#include <cstring>
+#include <string_view>
+
+using namespace std;
+
+ResultCache::ResultCache( size_t capacity )
+  : m_shard_capacity{ max<size_t>(capacity / NSHARDS, 1) }
+{}
+
+size_t ResultCache::Hash( Span<const double> key, uint64_t dbversion )
+{
+  string_view bytes( reinterpret_cast<const char*>(key.data()),
+                     key.size() * sizeof(double) );
+  return hash<string_view>{}(bytes) ^ (dbversion * 0x9E3779B97F4A7C15ULL);
+}
+
+// Compare bit patterns, so that e.g. -0 and +0 are different inputs
+bool ResultCache::Matches( const Entry& e, Span<const double> key,
+                           uint64_t dbversion )
+{
+  return e.dbversion == dbversion && e.key.size() == key.size() &&
+         memcmp(e.key.data(), key.data(), key.size() * sizeof(double)) == 0;
+}
+
+bool ResultCache::Find( Span<const double> key, uint64_t dbversion,
+                        vector<double>& values )
+{
+  size_t h = Hash(key, dbversion);
+  Shard& shard = GetShard(h);
+  lock_guard lock(shard.mutex);
+  auto [first, last] = shard.entries.equal_range(h);
+  for( auto it = first; it != last; ++it ) {
+    if( Matches(it->second, key, dbversion) ) {
+      values = it->second.values;
+      ++shard.stats.hits;
+      return true;
+    }
+  }
+  ++shard.stats.misses;
+  return false;
+}
+
+void ResultCache::Insert( Span<const double> key, uint64_t dbversion,
+                          Span<const double> values )
+{
+  size_t h = Hash(key, dbversion);
+  Shard& shard = GetShard(h);
+  lock_guard lock(shard.mutex);
+  // Another thread may have inserted the same input meanwhile
+  auto [first, last] = shard.entries.equal_range(h);
+  for( auto it = first; it != last; ++it ) {
+    if( Matches(it->second, key, dbversion) )
+      return;
+  }
+  if( shard.entries.size() >= m_shard_capacity ) {
+    auto [oh, oldest] = shard.order.front();
+    shard.order.pop_front();
+    auto [ofirst, olast] = shard.entries.equal_range(oh);
+    for( auto it = ofirst; it != olast; ++it ) {
+      if( &it->second == oldest ) {
+        shard.entries.erase(it);
+        break;
+      }
+    }
+    ++shard.stats.evictions;
+  }
+  auto it = shard.entries.emplace( h, Entry{ dbversion,
+    { key.begin(), key.end() }, { values.begin(), values.end() } } );
+  shard.order.emplace_back(h, &it->second);
+}
+
+ResultCache::Stats ResultCache::GetStats() const
+{
+  Stats total;
+  for( const auto& shard : m_shards ) {
+    lock_guard lock(shard.mutex);
+    total.hits += shard.stats.hits;
+    total.misses += shard.stats.misses;
+    total.evictions += shard.stats.evictions;
+    total.size += shard.entries.size();
+  }
+  return total;
+}
+
+void ResultCache::Print( const string& name, ostream& os ) const
+{
+  Stats s = GetStats();
+  uint64_t lookups = s.hits + s.misses;
+  os << "Result cache " << name << ": " << lookups << " lookups, "
+     << s.hits << " hits";
+  if( lookups > 0 )
+    os << " (" << 100.0 * double(s.hits) / double(lookups) << "%)";
+  os << ", " << s.misses << " misses, " << s.evictions << " evictions, "
+     << s.size << " entries" << endl;
+}
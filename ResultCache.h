@@ -0,0 +1,70 @@
+// Concurrent cache of detector results
+//
+// Maps the input of a detector, usually its raw module data, together with
+// the version of the database to the values of the detector's output
+// variables. It is shared by all clones of a detector. The entries are
+// split into shards, each with its own lock, so that analysis threads
+// rarely contend. A full shard evicts its oldest entry.
+
+#ifndef PPODD_RESULTCACHE
+#define PPODD_RESULTCACHE
+
+#include "Util.h"
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class ResultCache {
+public:
+  static constexpr size_t DEFAULT_CAPACITY = 65536;  // Entries
+  static constexpr size_t NSHARDS = 64;
+
+  explicit ResultCache( size_t capacity = DEFAULT_CAPACITY );
+
+  // Look up the results for input 'key' at database version 'dbversion'.
+  // If found, copy them to 'values' and return true.
+  bool Find( Span<const double> key, uint64_t dbversion,
+             std::vector<double>& values );
+
+  // Store 'values' as the results for 'key' and 'dbversion'
+  void Insert( Span<const double> key, uint64_t dbversion,
+               Span<const double> values );
+
+  struct Stats {
+    uint64_t hits{0};
+    uint64_t misses{0};
+    uint64_t evictions{0};
+    uint64_t size{0};
+  };
+  [[nodiscard]] Stats GetStats() const;
+
+  // Print the counters, labeled with 'name'
+  void Print( const std::string& name, std::ostream& os = std::cout ) const;
+
+private:
+  struct Entry {
+    uint64_t            dbversion;
+    std::vector<double> key;
+    std::vector<double> values;
+  };
+  struct Shard {
+    mutable std::mutex mutex;
+    std::unordered_multimap<size_t, Entry> entries;  // By hash of the key
+    std::deque<std::pair<size_t, const Entry*>> order;  // Oldest first
+    Stats stats;
+  };
+  size_t                      m_shard_capacity;
+  std::array<Shard, NSHARDS>  m_shards;
+
+  static size_t Hash( Span<const double> key, uint64_t dbversion );
+  static bool   Matches( const Entry& e, Span<const double> key,
+                         uint64_t dbversion );
+  Shard& GetShard( size_t hash ) { return m_shards[hash % NSHARDS]; }
+};
+
+#endif
@@ -81,8 +81,10 @@
 #include <thread>
 #include <mutex>
 #include <condition_variable>
+#include <exception>
 #include <cstdlib>
 #include <cassert>
+#include <functional>
 #include <memory>
 
 namespace ThreadUtil {
@@ -132,25 +134,28 @@ private:
   std::condition_variable data_cond;
 };
 
-template<typename Data_t>
+// The results may be of a different type than the work items, for
+// example when the workers return the work items to a free list themselves
+// and pass on only the part of the data needed downstream.
+template<typename Data_t, typename Result_t = Data_t>
 class QueuingThreadPool {
 public:
   // Normal constructor, using internal ResultQueue
   template<template<typename> class Action, typename T, typename... Args>
   QueuingThreadPool( size_t n, const Action<T>& action, Args&& ... args )
-          : fResultQueue(std::make_shared<ConcurrentQueue<Data_t>>()) {
+          : fResultQueue(std::make_shared<ConcurrentQueue<Result_t>>()) {
     AddThreads(n, action, std::forward<Args>(args)...);
   }
   // Constructor with shared_ptr to external ResultQueue
   template<template<typename> class Action, typename T, typename... Args>
-  QueuingThreadPool( size_t n, std::shared_ptr<ConcurrentQueue<Data_t>> rq,
+  QueuingThreadPool( size_t n, std::shared_ptr<ConcurrentQueue<Result_t>> rq,
                      const Action<T>& action, Args&& ... args )
           : fResultQueue(rq) {
     AddThreads(n, action, std::forward<Args>(args)...);
   }
   // Constructor with reference to external ResultQueue
   template<template<typename> class Action, typename T, typename... Args>
-  QueuingThreadPool( size_t n, ConcurrentQueue<Data_t>& rq,
+  QueuingThreadPool( size_t n, ConcurrentQueue<Result_t>& rq,
                      const Action<T>& action, Args&& ... args )
           : fResultQueue(&rq) {
     AddThreads(n, action, std::forward<Args>(args)...);
@@ -169,16 +174,16 @@ public:
     return fWorkQueue.wait_and_pop();
   }
   // Queue up processed data
-  void push_result( std::unique_ptr<Data_t> data ) {
+  void push_result( std::unique_ptr<Result_t> data ) {
     fResultQueue->push(std::move(data));
   }
   // Retrieve processed data
-  std::unique_ptr<Data_t> pop_result() {
+  std::unique_ptr<Result_t> pop_result() {
     return fResultQueue->wait_and_pop();
   }
 
   ConcurrentQueue<Data_t>& GetWorkQueue() { return fWorkQueue; }
-  ConcurrentQueue<Data_t>& GetResultQueue() { return *fResultQueue; }
+  ConcurrentQueue<Result_t>& GetResultQueue() { return *fResultQueue; }
 
   // Tell the threads to finish, then delete them
   void finish() {
@@ -194,7 +199,7 @@ public:
 private:
   std::vector<std::thread> fThreads;
   ConcurrentQueue<Data_t> fWorkQueue;
-  std::shared_ptr<ConcurrentQueue<Data_t>> fResultQueue;
+  std::shared_ptr<ConcurrentQueue<Result_t>> fResultQueue;
 
   template<template<typename> class Action, typename T, typename... Args>
   void AddThreads( size_t n, const Action<T>& action, Args&& ... args ) {
@@ -206,6 +211,114 @@ private:
   }
 };
 
+// A pool of threads running independent tasks, e.g. the parts of a job
+// that a TaskGroup runs concurrently. Tasks must not wait for other tasks.
+class TaskPool {
+public:
+  using Task = std::function<void()>;
+
+  explicit TaskPool( size_t n ) {
+    fThreads.reserve(n);
+    for( size_t i = 0; i < n; ++i ) {
+      fThreads.emplace_back([this] {
+        // A nullptr terminates the thread
+        while( auto task = fQueue.wait_and_pop() )
+          (*task)();
+      });
+    }
+  }
+  ~TaskPool() {
+    for( size_t i = 0, e = fThreads.size(); i < e; ++i )
+      fQueue.push(nullptr);
+    for( auto& t : fThreads )
+      t.join();
+  }
+  TaskPool( const TaskPool& ) = delete;
+  TaskPool& operator=( const TaskPool& ) = delete;
+
+  void submit( Task task ) {
+    fQueue.push(std::make_unique<Task>(std::move(task)));
+  }
+  // Run one queued task in the calling thread. Returns false if there was none.
+  bool run_one() {
+    auto task = fQueue.try_pop();
+    if( !task )
+      return false;
+    (*task)();
+    return true;
+  }
+
+private:
+  ConcurrentQueue<Task>    fQueue;
+  std::vector<std::thread> fThreads;
+};
+
+// Tasks run on a TaskPool and waited for together. If a task throws, the
+// first exception is rethrown by wait().
+class TaskGroup {
+public:
+  explicit TaskGroup( TaskPool& pool ) : fPool(pool) {}
+  ~TaskGroup() { wait_all(); }
+  TaskGroup( const TaskGroup& ) = delete;
+  TaskGroup& operator=( const TaskGroup& ) = delete;
+
+  void run( TaskPool::Task task ) {
+    {
+      std::lock_guard lock(fMutex);
+      ++fPending;
+    }
+    fPool.submit([this, task = std::move(task)] {
+      std::exception_ptr error;
+      try {
+        task();
+      }
+      catch( ... ) {
+        error = std::current_exception();
+      }
+      // Notify while holding the lock, so that the group cannot go away
+      // before we are done with it
+      std::lock_guard lock(fMutex);
+      if( error && !fError )
+        fError = error;
+      if( --fPending == 0 )
+        fDone.notify_all();
+    });
+  }
+  // Wait for all tasks of the group. Meanwhile, help with queued tasks.
+  // Rethrows the first exception thrown by a task.
+  void wait() {
+    wait_all();
+    std::exception_ptr error;
+    {
+      std::lock_guard lock(fMutex);
+      std::swap(error, fError);
+    }
+    if( error )
+      std::rethrow_exception(error);
+  }
+
+private:
+  TaskPool&               fPool;
+  std::mutex              fMutex;
+  std::condition_variable fDone;
+  size_t                  fPending{0};
+  std::exception_ptr      fError;
+
+  void wait_all() {
+    for(;;) {
+      {
+        std::lock_guard lock(fMutex);
+        if( fPending == 0 )
+          return;
+      }
+      if( !fPool.run_one() )
+        break;
+    }
+    std::unique_lock lock(fMutex);
+    fDone.wait(lock, [this] { return fPending == 0; });
+  }
+};
+
 #if __cplusplus >= 201701L
 // Template argument deduction guide
 template<template<typename> class Action, typename T, typename... Args>
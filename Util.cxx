@@ -3,6 +3,7 @@
 #include "Util.h"
 #include <thread>
 #include <random>
+#include <glob.h>
 
 #include <boost/tokenizer.hpp>
 
@@ -22,18 +23,27 @@ unsigned int GetThreadCount()
 // Comparisons are case-sensitive. Return true if there is a match.
 bool WildcardMatch( const string& candidate, const string& expr )
 {
+  return WildcardMatch(candidate, WildcardTokens(expr));
+}
 
+vector<string> WildcardTokens( const string& expr )
+{
   using tokenizer = boost::tokenizer<boost::char_separator<char>>;
 
   boost::char_separator<char> sep("*");
   tokenizer tokens( expr, sep );
+  return { tokens.begin(), tokens.end() };
+}
+
+bool WildcardMatch( const string& candidate, const vector<string>& tokens )
+{
   string::size_type pos = 0;
-  tokenizer::iterator tok = tokens.begin();
+  auto tok = tokens.begin();
   while( tok != tokens.end() &&
          pos < candidate.length() &&
          (pos = candidate.find(*tok,pos)) != string::npos )
     {
-      pos += (*tok).size();
+      pos += tok->size();
       ++tok;
     }
   return (tok == tokens.end());
@@ -46,3 +56,19 @@ int intRand( int min, int max )
   uniform_int_distribution<int> distribution(min, max);
   return distribution(generator);
 }
+
+// Append the names of all files matching the shell wildcard pattern
+// 'pattern' to 'names', in sorted order. If nothing matches, append
+// 'pattern' itself, so that a subsequent open reports the missing file.
+void ExpandFileNames( const string& pattern, vector<string>& names )
+{
+  glob_t g{};
+  if( pattern.find_first_of("*?[") != string::npos &&
+      glob(pattern.c_str(), 0, nullptr, &g) == 0 ) {
+    for( size_t i = 0; i < g.gl_pathc; ++i )
+      names.emplace_back(g.gl_pathv[i]);
+  } else {
+    names.push_back(pattern);
+  }
+  globfree(&g);
+}
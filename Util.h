@@ -3,6 +3,7 @@
 
 #include <algorithm>
 #include <string>
+#include <vector>
 #include <ctime>
 
 //___________________________________________________________________________
@@ -29,6 +30,33 @@ inline void CopyContainer( const Container& from, Container& to )
   std::for_each( from.begin(), from.end(), copy );
 }
 
+//___________________________________________________________________________
+// Unit of memory aligned to a cache line. Arrays of these do not share
+// cache lines with other data.
+struct CacheLine {
+  char bytes[64];
+} __attribute__((aligned(64)));
+
+//___________________________________________________________________________
+// Non-owning view of a contiguous array (stand-in for C++20 std::span)
+template< typename T >
+class Span {
+public:
+  constexpr Span() noexcept : m_ptr{nullptr}, m_size{0} {}
+  constexpr Span( T* ptr, size_t n ) noexcept : m_ptr{ptr}, m_size{n} {}
+
+  [[nodiscard]] constexpr T*     begin() const noexcept { return m_ptr; }
+  [[nodiscard]] constexpr T*     end()   const noexcept { return m_ptr + m_size; }
+  [[nodiscard]] constexpr T*     data()  const noexcept { return m_ptr; }
+  [[nodiscard]] constexpr size_t size()  const noexcept { return m_size; }
+  [[nodiscard]] constexpr bool   empty() const noexcept { return m_size == 0; }
+  constexpr T& operator[]( size_t i ) const { return m_ptr[i]; }
+
+private:
+  T*     m_ptr;
+  size_t m_size;
+};
+
 //___________________________________________________________________________
 /**
  * @fn timespec_diff(struct timespec *, struct timespec *, struct timespec *)
@@ -52,6 +80,12 @@ static inline void timespec_diff(struct timespec *a, struct timespec *b,
 
 unsigned int GetThreadCount();
 bool WildcardMatch( const std::string& candidate, const std::string& expr );
+// The same, with 'expr' split into the parts between its wildcards by
+// WildcardTokens, for matching many candidates
+std::vector<std::string> WildcardTokens( const std::string& expr );
+bool WildcardMatch( const std::string& candidate,
+                    const std::vector<std::string>& tokens );
 int intRand( int min, int max );
+void ExpandFileNames( const std::string& pattern, std::vector<std::string>& names );
 
 #endif
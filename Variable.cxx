@@ -2,28 +2,109 @@
 
 #include "Podd.h"
 #include "Variable.h"
+#include "Util.h"
 #include <iostream>
 #include <cassert>
 #include <algorithm>
+#include <memory>
+#include <mutex>
 
 using namespace std;
 
-Variable::Variable( string _name, string _note, const double* _loc )
-  : name(std::move(_name))
-  , note(std::move(_note))
+// Shared variable names and descriptions. Contexts may be initialized
+// concurrently.
+static const VarInfo* Intern( const string& name, const string& note )
+{
+  static mutex infomutex;
+  static unordered_map<string, unique_ptr<VarInfo>> infos;
+  lock_guard lock(infomutex);
+  auto& info = infos[name];
+  if( !info )
+    info = make_unique<VarInfo>(VarInfo{name, note});
+  return info.get();
+}
+
+Variable::Variable( const VarInfo* _info, const double* _loc )
+  : info(_info)
   , loc(_loc)
 {
-  assert(loc);
+  assert(info);
 }
 
 
 void Variable::Print() const
 {
-  cout << "VAR: " << name << " \"" << note << "\" = " << GetValue() << endl;
+  cout << "VAR: " << GetName() << " \"" << GetNote() << "\" = " << GetValue() << endl;
+}
+
+const Variable* VarList::Add( const string& name, const string& note,
+                              const double* loc )
+{
+  assert(loc);
+  if( m_index.count(name) )
+    return nullptr;
+  const VarInfo* info = Intern(name, note);
+  m_index.emplace(info->name, m_vars.size());
+  m_sorted.push_back(m_vars.size());
+  m_is_sorted = false;
+  m_vars.emplace_back(info, loc);
+  return &m_vars.back();
+}
+
+bool VarList::Remove( const string& name )
+{
+  auto it = m_index.find(name);
+  if( it == m_index.end() )
+    return false;
+  size_t pos = it->second;
+  m_index.erase(it);
+  m_vars[pos] = Variable(&m_vars[pos].GetInfo(), nullptr);
+  return true;
+}
+
+const Variable* VarList::Find( string_view name ) const
+{
+  auto it = m_index.find(name);
+  return it != m_index.end() ? &m_vars[it->second] : nullptr;
+}
+
+vector<const Variable*> VarList::FindPrefix( string_view prefix ) const
+{
+  if( !m_is_sorted ) {
+    sort( ALL(m_sorted), [this]( size_t a, size_t b ) {
+      return m_vars[a].GetName() < m_vars[b].GetName();
+    });
+    m_is_sorted = true;
+  }
+  auto first = lower_bound( ALL(m_sorted), prefix,
+    [this]( size_t a, string_view p ) { return m_vars[a].GetName() < p; });
+  vector<size_t> found;
+  for( auto it = first; it != m_sorted.end() &&
+         m_vars[*it].GetName().compare(0, prefix.size(), prefix) == 0; ++it ) {
+    if( m_vars[*it].GetLocation() )
+      found.push_back(*it);
+  }
+  sort( ALL(found) );
+  vector<const Variable*> ret;
+  ret.reserve(found.size());
+  for( auto pos : found )
+    ret.push_back(&m_vars[pos]);
+  return ret;
+}
+
+vector<const Variable*> VarList::Match( const string& expr ) const
+{
+  auto tokens = WildcardTokens(expr);
+  vector<const Variable*> ret;
+  ForEach( [&]( const Variable& var ) {
+    if( WildcardMatch(var.GetName(), tokens) )
+      ret.push_back(&var);
+  });
+  return ret;
 }
 
 // Declared in Podd.h
 void PrintVarList( const shared_ptr<varlst_t>& varlst )
 {
-  for_each( ALL(*varlst), [](auto& var){ var->Print(); });
+  varlst->ForEach( []( const Variable& var ){ var.Print(); });
 }
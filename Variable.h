@@ -4,20 +4,69 @@
 #define PPODD_VARIABLE
 
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Name and description of a variable. There is one instance per name,
+// shared by the variables of that name in all contexts.
+struct VarInfo {
+  std::string name;
+  std::string note;
+};
 
 class Variable {
 public:
-  Variable( std::string name, std::string note, const double* loc );
+  Variable( const VarInfo* info, const double* loc );
 
-  [[nodiscard]] const std::string& GetName() const { return name; }
-  [[nodiscard]] const std::string& GetNote() const { return note; }
+  [[nodiscard]] const std::string& GetName() const { return info->name; }
+  [[nodiscard]] const std::string& GetNote() const { return info->note; }
   [[nodiscard]] double GetValue() const { return *loc; }
+  [[nodiscard]] const double* GetLocation() const { return loc; }
+  [[nodiscard]] const VarInfo& GetInfo() const { return *info; }
   void Print() const;
 
 private:
-  std::string name;
-  std::string note;
+  const VarInfo* info;
   const double* loc;
 };
 
+// The analysis variables of one context. The variables are kept in
+// definition order in one array and indexed by name. Pointers to them
+// stay valid until the next Add.
+class VarList {
+public:
+  // Add variable 'name' with value at 'loc'. Returns nullptr if a
+  // variable of this name exists.
+  const Variable* Add( const std::string& name, const std::string& note,
+                       const double* loc );
+  // Remove variable 'name'. Returns false if there is none.
+  bool Remove( const std::string& name );
+
+  [[nodiscard]] const Variable* Find( std::string_view name ) const;
+  // Variables whose names start with 'prefix', in definition order
+  [[nodiscard]] std::vector<const Variable*> FindPrefix( std::string_view prefix ) const;
+  // Variables whose names match the wildcard expression 'expr' (see
+  // WildcardMatch), in definition order
+  [[nodiscard]] std::vector<const Variable*> Match( const std::string& expr ) const;
+
+  [[nodiscard]] size_t size()  const { return m_index.size(); }
+  [[nodiscard]] bool   empty() const { return m_index.empty(); }
+
+  // Call f(var) for all variables, in definition order
+  template<typename F> void ForEach( F f ) const {
+    for( const auto& var : m_vars )
+      if( var.GetLocation() )
+        f(var);
+  }
+
+private:
+  std::vector<Variable> m_vars;  // Removed variables have a null location
+  std::unordered_map<std::string_view, size_t> m_index;  // Position by name
+  // Positions in order of name, for prefix lookups, including removed
+  // variables. Sorted on demand.
+  mutable std::vector<size_t> m_sorted;
+  mutable bool m_is_sorted{true};
+};
+
 #endif
@@ -0,0 +1,258 @@
+// Check the SIMD kernels of detector types A and B
+//
+// Analyzes random events in batches of various sizes and checks that
+//  - the results of each event do not depend on the batch size, on the
+//    event's position in the batch, or on whether the event is analyzed
+//    on its own with Analyze(), and
+//  - the results agree with a scalar reference computed in long double
+//    within a relative tolerance.
+// Returns 0 if all checks pass.
+
+#include "Podd.h"
+#include "Decoder.h"
+#include "DetectorTypeA.h"
+#include "DetectorTypeB.h"
+#include "Variable.h"
+
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+// Definitions of global items declared in Podd.h
+int debug = 0;
+Config cfg;
+
+static constexpr double TOLERANCE = 1e-11;  // Relative
+
+// Module sizes up to these cover both the one-event-per-lane and the
+// spread-over-lanes code paths
+static constexpr size_t MAXVAL_A = 48;    // Values of module 1 (detA)
+static constexpr size_t MAXPTS_B = 24;    // Points of module 2 (detB)
+
+using Values = map<string, double>;
+
+// Random event with a module for each detector
+static vector<uint64_t> MakeEvent( mt19937_64& rng )
+{
+  uniform_int_distribution<size_t> na(0, MAXVAL_A), nb(0, MAXPTS_B);
+  uniform_real_distribution<double> val(-50, 50), xval(0, 10), noise(-0.5, 0.5);
+  uniform_int_distribution<int> rare(0, 99);
+
+  vector<double> a(na(rng)), b(2*nb(rng));
+  for( auto& x : a ) {
+    // Include zeros, for which the sum of log|x| needs the scalar code
+    x = rare(rng) == 0 ? 0.0 : val(rng);
+  }
+  double inter = val(rng), slope = val(rng) / 10;
+  for( size_t i = 0; i < b.size(); i += 2 ) {
+    b[i] = xval(rng);
+    b[i+1] = inter + slope * b[i] + noise(rng);
+  }
+
+  size_t len = sizeof(EventHeader) + 2 * sizeof(ModuleHeader)
+               + (a.size() + b.size()) * sizeof(double);
+  vector<uint64_t> buf(len / sizeof(uint64_t));
+  auto* p = reinterpret_cast<char*>(buf.data());
+  EventHeader eh(len, 2);
+  memcpy(p, &eh, sizeof(eh));
+  p += sizeof(eh);
+  uint16_t imod = 1;
+  for( const auto* v : { &a, &b } ) {
+    ModuleHeader mh(sizeof(mh) + v->size() * sizeof(double), imod++, v->size());
+    memcpy(p, &mh, sizeof(mh));
+    p += sizeof(mh);
+    memcpy(p, v->data(), v->size() * sizeof(double));
+    p += v->size() * sizeof(double);
+  }
+  return buf;
+}
+
+// Scalar reference for detector A
+static Values ReferenceA( const double* x, size_t n )
+{
+  Values v{ {"nval", double(n)}, {"sum", 0}, {"min", 1e38}, {"max", -1e38},
+            {"mean", 0}, {"geom", 0} };
+  if( n == 0 )
+    return v;
+  long double sum = 0, logsum = 0;
+  for( size_t i = 0; i < n; ++i ) {
+    sum += x[i];
+    logsum += logl(fabsl(x[i]));
+    v["min"] = std::min(v["min"], x[i]);
+    v["max"] = std::max(v["max"], x[i]);
+  }
+  v["sum"] = double(sum);
+  v["mean"] = double(sum / n);
+  v["geom"] = double(expl(logsum / n));
+  return v;
+}
+
+// Scalar reference for detector B
+static Values ReferenceB( const double* p, size_t ndata )
+{
+  Values v{ {"slope", 1e38}, {"inter", 1e38}, {"cov11", 1e38},
+            {"cov22", 1e38}, {"cov12", 1e38}, {"ndof", 0}, {"chi2", 1e38} };
+  size_t n = ndata / 2;
+  if( n < 3 )
+    return v;
+  long double S11 = n, S12 = 0, S22 = 0, G1 = 0, G2 = 0;
+  for( size_t i = 0; i < n; ++i ) {
+    long double x = p[2*i], y = p[2*i+1];
+    S12 += x;
+    S22 += x*x;
+    G1  += y;
+    G2  += x*y;
+  }
+  long double D = 1.0L / (S11*S22 - S12*S12);
+  long double inter = (G1*S22 - G2*S12)*D;
+  long double slope = (G2*S11 - G1*S12)*D;
+  long double chi2 = 0;
+  for( size_t i = 0; i < n; ++i ) {
+    long double d = inter + slope*p[2*i];
+    chi2 += d*d;
+  }
+  v["slope"] = double(slope);
+  v["inter"] = double(inter);
+  v["cov11"] = double(S11*D);
+  v["cov22"] = double(S22*D);
+  v["cov12"] = double(-S12*D);
+  v["ndof"]  = double(n) - 2.0;
+  v["chi2"]  = double(chi2);
+  return v;
+}
+
+// A detector and the names and positions of its output variables in the
+// result rows
+struct Setup {
+  Detector* det;
+  vector<string> names;
+  size_t rowsize;
+};
+
+static Setup Connect( Detector& det )
+{
+  auto vars = make_shared<VarList>();
+  det.SetVarList(vars);
+  det.Init(false);
+  Setup s{ &det, {}, 0 };
+  for( const auto* var : vars->FindPrefix(det.GetName() + '.') ) {
+    det.AddOutput(s.rowsize, var->GetLocation());
+    s.names.push_back(var->GetName().substr(det.GetName().size() + 1));
+    s.rowsize += sizeof(double);
+  }
+  return s;
+}
+
+// Analyze 'events' in batches of 'nbatch'. With nbatch = 0, run the
+// generic batch code, which calls Analyze() for each event.
+static vector<char> Run( Setup& s, vector<Decoder>& events, size_t nbatch )
+{
+  vector<char> rows(events.size() * s.rowsize);
+  size_t step = nbatch > 0 ? nbatch : events.size();
+  for( size_t i0 = 0; i0 < events.size(); i0 += step ) {
+    size_t n = std::min(step, events.size() - i0);
+    Span<Decoder> batch{ &events[i0], n };
+    ResultRows results{ rows.data() + i0 * s.rowsize, s.rowsize };
+    if( nbatch > 0 )
+      s.det->AnalyzeBatch(batch, results);
+    else
+      s.det->Detector::AnalyzeBatch(batch, results);
+  }
+  return rows;
+}
+
+static bool Agree( double a, double b )
+{
+  if( a == b || (std::isnan(a) && std::isnan(b)) )
+    return true;
+  return fabs(a - b) <= TOLERANCE * std::max(fabs(a), fabs(b));
+}
+
+int main( int argc, char** argv )
+{
+  size_t nev = 5000;
+  int opt;
+  while( (opt = getopt(argc, argv, "n:h")) != -1 ) {
+    switch( opt ) {
+      case 'n':
+        nev = stoul(optarg);
+        break;
+      default:
+        cerr << "Usage: " << argv[0] << " [ -n nev ]" << endl;
+        return 255;
+    }
+  }
+
+  mt19937_64 rng(12345);
+  vector<vector<uint64_t>> buffers;
+  vector<Decoder> events(nev);
+  for( size_t i = 0; i < nev; ++i ) {
+    buffers.push_back(MakeEvent(rng));
+    if( events[i].Load(reinterpret_cast<const evbuf_t*>(buffers.back().data())) != 0 ) {
+      cerr << "Error loading event " << i << endl;
+      return 1;
+    }
+  }
+
+  DetectorTypeA detA("detA", 1);
+  DetectorTypeB detB("detB", 2);
+  int nfail = 0;
+  for( Detector* det : { (Detector*)&detA, (Detector*)&detB } ) {
+    Setup s = Connect(*det);
+    const int imod = det->GetModule();
+
+    // Identical results, however the events are batched
+    auto ref = Run(s, events, 0);
+    for( size_t nbatch : { 1, 2, 3, 4, 5, 7, 8, 9, 16, 17, 64 } ) {
+      auto rows = Run(s, events, nbatch);
+      for( size_t i = 0; i < nev; ++i ) {
+        if( memcmp(rows.data() + i * s.rowsize, ref.data() + i * s.rowsize,
+                   s.rowsize) != 0 ) {
+          cerr << det->GetName() << ": event " << i << " differs in batches of "
+               << nbatch << endl;
+          ++nfail;
+          break;
+        }
+      }
+    }
+
+    // Agreement with the reference
+    map<string, double> maxdev;
+    for( size_t i = 0; i < nev; ++i ) {
+      auto n = events[i].GetNdata(imod);
+      const double* p = n > 0 ? events[i].GetDataBuf(imod) : nullptr;
+      Values expect = (det == &detA) ? ReferenceA(p, n) : ReferenceB(p, n);
+      for( size_t k = 0; k < s.names.size(); ++k ) {
+        double got;
+        memcpy(&got, ref.data() + i * s.rowsize + k * sizeof(double), sizeof(got));
+        double want = expect.at(s.names[k]);
+        if( !Agree(got, want) ) {
+          cerr << det->GetName() << "." << s.names[k] << ": event " << i
+               << ": got " << got << ", expected " << want << endl;
+          ++nfail;
+        } else if( got != want ) {
+          double dev = fabs(got - want) / std::max(fabs(got), fabs(want));
+          maxdev[s.names[k]] = std::max(maxdev[s.names[k]], dev);
+        }
+      }
+    }
+    cout << det->GetName() << ": max. relative deviation from reference:";
+    for( const auto& name : s.names )
+      cout << " " << name << " " << maxdev[name];
+    cout << endl;
+  }
+
+  if( nfail > 0 ) {
+    cout << nfail << " checks failed" << endl;
+    return 1;
+  }
+  cout << "All checks passed" << endl;
+  return 0;
+}
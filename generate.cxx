@@ -1,34 +1,43 @@
 // Generate and write test data file
 //
-// For the file format generated, see rawdata.h
+// For the file formats generated, see rawdata.h
 
 #include <cstdio>
 #include <cstdlib>
 #include <cstdint>
 #include <cstring>
 #include <cmath>
+#include <algorithm>
 #include <iostream>
 #include <unistd.h>
 #include <cassert>
 #include <tuple>
 #include <stdexcept>
-//#include <vector>
+#include <vector>
 #include <memory>
 #include <sstream>
+#include <fstream>
 
 #include "rawdata.h"
+#include "RawWriter.h"
 
 using namespace std;
 
 // Configuration
-static constexpr size_t SIZE = 1024;
 static constexpr long int seed = 87934;
+static constexpr unsigned MAXNDATA = 0xFFFF;  // Limit of ModuleHeader::module_ndata
+static constexpr unsigned NDATA_B = 16;       // Maximum data for type B modules
 struct Config {
   const char* prgname{""};
   const char* filename{""};
   int debug{0};
   unsigned NEVT{10000};
   unsigned NDET{1};
+  unsigned MAXDATA{16};      // Maximum data values per (type A) module
+  unsigned block_events{0};  // 0 = version 1 file
+  unsigned nbits{0};         // 0 = write doubles
+  const char* types{""};     // Module types, repeated over all modules
+  const char* list_file{""}; // Detector list for the modules, if any
 };
 static Config conf;
 
@@ -51,6 +60,33 @@ tuple<double,double> gauss()
   return make_tuple(x1*w, x2*w);
 }
 
+// Type of module 'idet' (A, B or C, see main). By default, modules 2 and
+// 3 are of types B and C and all others of type A.
+static char module_type( unsigned idet )
+{
+  if( *conf.types )
+    return conf.types[idet % strlen(conf.types)];
+  return idet == 1 ? 'B' : (idet == 2 ? 'C' : 'A');
+}
+
+// Write a detector list for the analyzer (option -l) with one detector
+// per module, named after its type and module number
+static int write_list_file()
+{
+  ofstream ofs(conf.list_file);
+  if( !ofs ) {
+    cerr << "Error opening detector list file " << conf.list_file << endl;
+    return 1;
+  }
+  ofs << "# Detectors for " << conf.filename << endl
+      << "# type name module_number" << endl;
+  for( unsigned idet = 0; idet < conf.NDET; ++idet ) {
+    char type = module_type(idet);
+    ofs << type << " det" << type << idet+1 << " " << idet+1 << endl;
+  }
+  return ofs ? 0 : 1;
+}
+
 // Usage message
 static void usage()
 {
@@ -58,6 +94,16 @@ static void usage()
        << "where options are:" << endl
        << " [ -c num ]\tnumber of detectors to simulate (default 1)" << endl
        << " [ -n nev_max ]\t\tset number of events (default 10000)" << endl
+       << " [ -m max_data ]\tmaximum data values per module (default 16)"
+       << endl
+       << " [ -b nev_block ]\twrite blocked (version 2) file with"
+       << " nev_block events per block" << endl
+       << " [ -P nbits ]\t\tencode data as packed integers of nbits"
+       << " bits (1-32)" << endl
+       << " [ -T types ]\t\tmodule types (A, B or C), repeated over all"
+       << " modules (default ABC, then A)" << endl
+       << " [ -L det_file ]\twrite matching detector list to det_file"
+       << endl
        << " [ -d debug_level ]\tset debug level (default 0)" << endl
        << " [ -h ]\t\t\tprint this help message" << endl;
   exit(255);
@@ -82,6 +128,43 @@ public:
     memcpy(m_evtp, &evthdr, sizeof(evthdr) );
     m_evtp += sizeof(evthdr);
   }
+  void append_packed(uint32_t idet, uint32_t ndata, EvDat_t* data, uint32_t nbits) {
+    // Quantize the data to nbits over the range of values of this module
+    const uint64_t maxcode = (uint64_t(1) << nbits) - 1;
+    double lo = 0, hi = 0;
+    if( ndata > 0 ) {
+      auto [pmin, pmax] = minmax_element(data, data+ndata);
+      lo = *pmin;
+      hi = *pmax;
+    }
+    PackedHeader phdr{};
+    phdr.offset = lo;
+    phdr.scale = float((hi - lo) / double(maxcode));
+    phdr.nbits = nbits;
+    size_t len = sizeof(ModuleHeader) + sizeof(phdr) + PackedSize(ndata, nbits);
+    len = (len + 7) & ~size_t(7);
+    ModuleHeader modhdr( len, (idet+1) | MODNUM_PACKED, ndata );
+    size_t size_now = len + m_evtp - m_bufstart;
+    if( size_now > m_nwords * m_wordsz ) {
+      ostringstream ostr;
+      ostr << "Event too large, size = " << size_now << endl;
+      throw runtime_error(ostr.str());
+    }
+    memset(m_evtp, 0, len);
+    memcpy(m_evtp, &modhdr, sizeof(modhdr) );
+    memcpy(m_evtp + sizeof(modhdr), &phdr, sizeof(phdr) );
+    auto* p = (unsigned char*)m_evtp + sizeof(modhdr) + sizeof(phdr);
+    size_t bitpos = 0;
+    for( uint32_t i = 0; i < ndata; ++i, bitpos += nbits ) {
+      uint64_t code = 0;
+      if( phdr.scale > 0 )
+        code = min<uint64_t>(maxcode, llround((data[i] - lo) / phdr.scale));
+      code <<= bitpos % 8;
+      for( size_t k = bitpos / 8; code; ++k, code >>= 8 )
+        p[k] |= code & 0xFF;
+    }
+    m_evtp += len;
+  }
   void append_module(uint32_t idet, uint32_t ndata, EvDat_t* data) {
     ModuleHeader modhdr( sizeof(modhdr) + ndata*sizeof(EvDat_t),
                          idet+1, // in the data file, module numbers start counting at 1
@@ -98,20 +181,19 @@ public:
     memcpy(m_evtp, data, ndata * sizeof(EvDat_t) );
     m_evtp += ndata * sizeof(EvDat_t);
   }
-  void write( FILE* file ) {
+  void write( RawWriter& writer ) {
     // Calculate total event length
     auto *buf = (EvBuf_t*)m_bufstart;
     buf[0] = m_evtp-m_bufstart;
     // Write the buffer to file
-    size_t c = fwrite( buf, 1, buf[0], file );
-    if( c != buf[0] ) {
+    if( writer.WriteEvent( buf, buf[0] ) != 0 ) {
       throw runtime_error("File write error");
     }
   }
 private:
   const size_t m_nwords;
   const size_t m_wordsz;
-  unique_ptr<uint32_t> m_buf;
+  unique_ptr<EvBuf_t[]> m_buf;
   char* m_bufstart;
   char* m_evtp;
 };
@@ -124,12 +206,24 @@ void get_args( int argc, char** argv )
     conf.prgname += 2;
 
   int opt;
-  while( (opt = getopt(argc, argv, "c:d:n:h")) != -1 ) {
+  while( (opt = getopt(argc, argv, "b:c:d:m:n:L:P:T:h")) != -1 ) {
     switch (opt) {
+      case 'b':
+        conf.block_events = stoi(optarg);
+        break;
       case 'c':
         conf.NDET = stoi(optarg);
-        if( conf.NDET > MAXMODULES ) {
-          cerr << "Too many detectors, max " << MAXMODULES << endl;
+        if( conf.NDET < 1 || conf.NDET > MODNUM_NUMBER ) {
+          cerr << "Number of detectors must be between 1 and "
+               << MODNUM_NUMBER << endl;
+          exit(255);
+        }
+        break;
+      case 'm':
+        conf.MAXDATA = stoi(optarg);
+        if( conf.MAXDATA < 1 || conf.MAXDATA > MAXNDATA ) {
+          cerr << "Maximum data values must be between 1 and "
+               << MAXNDATA << endl;
           exit(255);
         }
         break;
@@ -139,6 +233,23 @@ void get_args( int argc, char** argv )
       case 'n':
         conf.NEVT = stoi(optarg);
         break;
+      case 'P':
+        conf.nbits = stoi(optarg);
+        if( conf.nbits < 1 || conf.nbits > 32 ) {
+          cerr << "Number of bits must be between 1 and 32" << endl;
+          exit(255);
+        }
+        break;
+      case 'T':
+        conf.types = optarg;
+        if( !*conf.types || strspn(conf.types, "ABC") != strlen(conf.types) ) {
+          cerr << "Module types must be a string of A, B and C" << endl;
+          exit(255);
+        }
+        break;
+      case 'L':
+        conf.list_file = optarg;
+        break;
       case 'h':
       default:
         usage();
@@ -157,14 +268,18 @@ int main( int argc, char** argv )
   get_args(argc, argv);
 
   // Open output
-  FILE* file = fopen(conf.filename, "wb");
-  if( !file ) {
-    cerr << "Cannot open file " << conf.filename << endl;
+  RawWriter writer(conf.block_events);
+  if( writer.Open(conf.filename) != 0 )
     exit(1);
-  }
 
   srand48(seed);
-  EventBuffer evbuffer(SIZE);
+  // Event buffer large enough for all modules at their maximum size,
+  // including the headers of packed modules
+  const unsigned maxdata = max(conf.MAXDATA, NDATA_B);
+  vector<EvDat_t> data(maxdata);
+  EventBuffer evbuffer( 2 + size_t(conf.NDET) *
+                        (sizeof(ModuleHeader) + sizeof(PackedHeader) +
+                         maxdata * sizeof(EvDat_t)) / sizeof(uint32_t) );
 
   try {
     // Generate event data
@@ -172,16 +287,15 @@ int main( int argc, char** argv )
       evbuffer.fill_header(conf.NDET);
       for( unsigned idet = 0; idet < conf.NDET; ++idet ) {
         unsigned ndata;
-        EvDat_t data[MAXDATA];
-        switch( idet ) {
-          case 1:
+        switch( module_type(idet) ) {
+          case 'B':
             // Module type 2 wants 4-8 data points for linear fit
             ndata = unsigned(5. * drand48()) + 4;
             {
               double slope = (2.0 * drand48() - 1.0);
               double inter = (2.0 * drand48() - 1.0);
               for( unsigned i = 0; i < ndata; ++i ) {
-                assert(2 * i + 1 < MAXDATA);
+                assert(2 * i + 1 < NDATA_B);
                 // y = error + intercept + slope*x;
                 auto [y1,y2] = gauss();
                 double x = i - 3.5 + drand48();
@@ -191,7 +305,7 @@ int main( int argc, char** argv )
             }
             ndata *= 2;
             break;
-          case 2:
+          case 'C':
             // Module type 3 wants a single data word indicating the desired precision
             ndata = 1;
             data[0] = 0.0;
@@ -202,30 +316,38 @@ int main( int argc, char** argv )
             break;
           default:
             // Generate between 1 and MAXDATA random data values per module
-            ndata = unsigned(MAXDATA * drand48()) + 1;
+            ndata = unsigned(conf.MAXDATA * drand48()) + 1;
             for( unsigned i = 0; i < ndata; ++i ) {
               data[i] = 20.0 * drand48() - 10.0;
             }
             break;
         }
 
-        evbuffer.append_module(idet, ndata, data);
+        if( conf.nbits > 0 )
+          evbuffer.append_packed(idet, ndata, data.data(), conf.nbits);
+        else
+          evbuffer.append_module(idet, ndata, data.data());
       }
-      evbuffer.write(file);
+      evbuffer.write(writer);
     }
   }
   catch ( const exception& e ) {
     cerr << "Error while generating events: " << e.what() << endl;
-    fclose(file);
+    writer.Close();
     return 1;
   }
 
-  if( fclose(file) != 0) {
+  if( writer.Close() != 0 ) {
     cerr << "Error writing output file " << conf.filename << endl;
     return 1;
   }
+  if( *conf.list_file && write_list_file() != 0 )
+    return 1;
   cout << "Successfully generated " << conf.NEVT << " events for "
-       << conf.NDET << " detectors" << endl;
+       << conf.NDET << " detectors";
+  if( conf.block_events > 0 )
+    cout << " in " << writer.GetNblocks() << " blocks";
+  cout << endl;
 
   return 0;
 }
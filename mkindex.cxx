@@ -0,0 +1,96 @@
+// Build the event index for a raw data file
+//
+// For the index format, see EventIndex.h
+
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+
+#include "EventIndex.h"
+
+using namespace std;
+
+// Configuration
+struct Config {
+  const char* prgname{""};
+  const char* filename{""};
+  string idxfile;
+  int debug{0};
+  bool list_sync{false};
+};
+static Config conf;
+
+// Usage message
+static void usage()
+{
+  cerr << "Usage: " << conf.prgname << " [options] data_file" << endl
+       << "where options are:" << endl
+       << " [ -o index_file ]\twrite index to index_file"
+       << " (default = data_file.idx)" << endl
+       << " [ -l ]\t\t\tlist sync events" << endl
+       << " [ -d debug_level ]\tset debug level (default 0)" << endl
+       << " [ -h ]\t\t\tprint this help message" << endl;
+  exit(255);
+}
+
+// Command line parser
+void get_args( int argc, char** argv )
+{
+  conf.prgname = argv[0];
+  if( strlen(conf.prgname) >= 2 && strncmp(conf.prgname,"./",2) == 0 )
+    conf.prgname += 2;
+
+  int opt;
+  while( (opt = getopt(argc, argv, "d:o:lh")) != -1 ) {
+    switch (opt) {
+      case 'd':
+        conf.debug = stoi(optarg);
+        break;
+      case 'o':
+        conf.idxfile = optarg;
+        break;
+      case 'l':
+        conf.list_sync = true;
+        break;
+      case 'h':
+      default:
+        usage();
+        break;
+    }
+  }
+  if( optind >= argc ) {
+    cerr << "Data file name missing" << endl;
+    usage();
+  }
+  conf.filename = argv[optind];
+  if( conf.idxfile.empty() )
+    conf.idxfile = EventIndex::DefaultName(conf.filename);
+}
+
+int main( int argc, char** argv )
+{
+  get_args(argc, argv);
+
+  EventIndex index;
+  if( index.Build(conf.filename) != 0 )
+    return 1;
+  if( index.Write(conf.idxfile) != 0 )
+    return 1;
+
+  if( conf.list_sync ) {
+    auto sync = index.GetSyncEvents();
+    cout << sync.size() << " sync events" << (sync.empty() ? "" : ":") << endl;
+    for( auto evnum : sync ) {
+      const auto& e = index.GetEntry(evnum);
+      cout << evnum << "\toffset = " << e.offset
+           << "\tlength = " << e.length << endl;
+    }
+  }
+  cout << "Indexed " << index.GetNevents() << " events in " << conf.filename;
+  if( conf.debug > 0 )
+    cout << ", wrote " << conf.idxfile;
+  cout << endl;
+
+  return 0;
+}
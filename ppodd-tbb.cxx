@@ -2,13 +2,14 @@
 
 #include "Podd.h"
 #include "DataFile.h"
-#include "DetectorTypeA.h"
-#include "DetectorTypeB.h"
-#include "DetectorTypeC.h"
+#include "Detector.h"
 #include "Output.h"
 #include "Util.h"
 #include "Context.h"
 #include "Database.h"
+#include "PartitionedInput.h"
+#include "FileChain.h"
+#include "BlockCompressor.h"
 
 #include <iostream>
 #include <unistd.h>
@@ -21,7 +22,10 @@
 #include <stdexcept>
 #include <cstring>
 #include <sstream>
+#include <iomanip>
 #include <numeric>
+#include <algorithm>
+#include <atomic>
 
 #include <oneapi/tbb/flow_graph.h>
 #include <oneapi/tbb/global_control.h>
@@ -30,7 +34,6 @@
 // For output module
 #include <fstream>
 //#include <boost/iostreams/filtering_stream.hpp>
-#include <boost/iostreams/filter/gzip.hpp>
 
 using namespace std;
 using namespace tbb;
@@ -83,7 +86,7 @@ void Config::default_names() {
 
 //-------------------------------------------------------------
 static void usage() {
-  cerr << "Usage: " << prgname << " [options] input_file.dat" << endl
+  cerr << "Usage: " << prgname << " [options] input_file.dat ..." << endl
        << "where options are:" << endl
        << " [ -c odef_file ]\tread output definitions from odef_file"
        << " (default = input_file.odef)" << endl
@@ -91,13 +94,25 @@ static void usage() {
        << " (default = input_file.odat)" << endl
        << " [ -b db_file ]\t\tuse database file db_file"
        << " (default = input_file.db)" << endl
+       << " [ -l det_file ]\t\tcreate the detectors listed in det_file"
+       << " (default = built-in set)" << endl
        << " [ -d debug_level ]\tset debug level" << endl
        << " [ -n nev_max ]\t\tset max number of events" << endl
+       << " [ -s first_event ]\tstart at event number first_event (default = 1)" << endl
        << " [ -j nthreads ]\tcreate at most nthreads (default = n_cpus)" << endl
        << " [ -y us ]\t\tAdd us microseconds average random delay per event" << endl
+       << " [ -g nev_batch ]\tAnalyze events in batches of nev_batch (default = 16)" << endl
+       << " [ -t us ]\t\tRun detectors taking at least us microseconds per batch" << endl
+       << "\t\t\tconcurrently (default = off)" << endl
        << " [ -e (sync|strict) ]\tPreserve event order" << endl
        << " [ -m interval ]\tMark progress at given intervals" << endl
+       << " [ -r (stdio|mmap|prefetch) ] Method for reading input (default = stdio)" << endl
+       << " [ -B block_MB ]\tBlock size for -r prefetch (default = 8)" << endl
+       << " [ -p nev_chunk ]\tRead input in parallel, in chunks of nev_chunk events" << endl
+       << " [ -F ]\t\t\tRead input files in parallel, one reader per file" << endl
+       << "\t\t\t(use small chunks with -e strict)" << endl
        << " [ -z ]\t\t\tCompress output with gzip" << endl
+       << " [ -Z ]\t\t\tCompress output with zstd" << endl
        << " [ -h ]\t\t\tPrint this help message" << endl;
   exit(255);
 }
@@ -114,7 +129,7 @@ void get_args(int argc, char* const* argv )
 
   try {
     int opt;
-    while( (opt = getopt(argc, argv, "b:c:d:n:o:j:y:e:m:zmh")) != -1 ) {
+    while( (opt = getopt(argc, argv, "b:c:d:l:n:o:j:y:e:g:m:p:r:s:t:B:FzZmh")) != -1 ) {
       switch( opt ) {
         case 'b':
           cfg.db_file = optarg;
@@ -122,12 +137,23 @@ void get_args(int argc, char* const* argv )
         case 'c':
           cfg.odef_file = optarg;
           break;
+        case 'l':
+          cfg.det_file = optarg;
+          break;
         case 'd':
           debug = stoi(optarg);
           break;
         case 'n':
           cfg.nev_max = stoi(optarg);
           break;
+        case 'B':
+          cfg.read_block_size = stoul(optarg) * 1024 * 1024;
+          break;
+        case 's':
+          cfg.first_event = stoul(optarg);
+          if( cfg.first_event == 0 )
+            cfg.first_event = 1;
+          break;
         case 'o':
           cfg.output_file = optarg;
           break;
@@ -145,6 +171,14 @@ void get_args(int argc, char* const* argv )
         case 'y':
           delay_us = stoi(optarg);
           break;
+        case 'g':
+          cfg.batch_size = stoul(optarg);
+          if( cfg.batch_size == 0 )
+            cfg.batch_size = 1;
+          break;
+        case 't':
+          cfg.task_threshold = stod(optarg);
+          break;
         case 'e':
           if( !optarg ) usage();
           if( !strcmp(optarg, "strict") ) {
@@ -158,9 +192,29 @@ void get_args(int argc, char* const* argv )
         case 'z':
           compress_output = 1;
           break;
+        case 'Z':
+          compress_output = 2;
+          break;
         case 'm':
           cfg.mark = stoi(optarg);
           break;
+        case 'p':
+          cfg.nev_chunk = stoul(optarg);
+          break;
+        case 'F':
+          cfg.parallel_files = true;
+          break;
+        case 'r':
+          if( !strcmp(optarg, "stdio") ) {
+            cfg.read_mode = DataFile::kStdio;
+          } else if( !strcmp(optarg, "mmap") ) {
+            cfg.read_mode = DataFile::kMmap;
+          } else if( !strcmp(optarg, "prefetch") ) {
+            cfg.read_mode = DataFile::kPrefetch;
+          } else {
+            usage();
+          }
+          break;
         case 'h':
         default:
           usage();
@@ -176,119 +230,187 @@ void get_args(int argc, char* const* argv )
     cerr << "Input file name missing" << endl;
     usage();
   }
-  cfg.input_file = argv[optind];
+  // Several input files, or wildcard patterns, form one stream of events
+  for( int i = optind; i < argc; ++i )
+    ExpandFileNames(argv[i], cfg.input_files);
+  cfg.input_file = cfg.input_files.front();
   cfg.default_names();
 
-  if( compress_output > 0 && cfg.output_file.size() > 3
-      && cfg.output_file.substr(cfg.output_file.size() - 3) != ".gz" )
-    cfg.output_file.append(".gz");
+  // Special events stop the flow one event at a time. Strict ordering of
+  // partitioned input sequences contexts by event number.
+  if( mode == kPreserveSpecial ||
+      (mode == kOrdered && (cfg.nev_chunk > 0 || cfg.parallel_files)) )
+    cfg.batch_size = 1;
+
+  if( compress_output > 0 ) {
+    const string ext = (compress_output == 2) ? ".zst" : ".gz";
+    if( cfg.output_file.size() > ext.size() &&
+        cfg.output_file.compare(cfg.output_file.size() - ext.size(),
+                                ext.size(), ext) != 0 )
+      cfg.output_file.append(ext);
+  }
 
   if( debug > 0 ) {
     cout << "input_file        = " << cfg.input_file    << endl;
+    if( cfg.input_files.size() > 1 )
+      cout << "input_files       = " << cfg.input_files.size() << " files" << endl;
     cout << "db_file           = " << cfg.db_file       << endl;
+    cout << "det_file          = " << cfg.det_file      << endl;
     cout << "odef_file         = " << cfg.odef_file     << endl;
     cout << "output_file       = " << cfg.output_file   << endl;
     cout << "compress_output   = " << compress_output   << endl;
+    cout << "read_mode         = " << cfg.read_mode     << endl;
+    cout << "read_block_size   = " << cfg.read_block_size << endl;
+    cout << "nev_chunk         = " << cfg.nev_chunk     << endl;
+    cout << "batch_size        = " << cfg.batch_size    << endl;
+    cout << "task_threshold    = " << cfg.task_threshold << endl;
     cout << "ordering mode     = " << mode              << endl;
   }
 }
 
 //-------------------------------------------------------------
-// Wrapper object around event buffer. Includes metadata about the
-// buffer contents
-class EventBuffer {
+// Batch of consecutive events read from the input, including metadata
+// about each event. Batches are recycled by the EventReader.
+class EventBatch {
 public:
-  EventBuffer();
-  [[nodiscard]] evbuf_t*     get()        const { return m_buffer.get(); }
-  [[nodiscard]] evbuf_ptr_t& getptr()           { return m_buffer; }
-  [[nodiscard]] size_t       evtnum()     const { return m_evtnum; }
-  [[nodiscard]] size_t       size()       const { return m_bufsiz; }
-  [[nodiscard]] int          type()       const { return m_type; }
-  [[nodiscard]] bool         is_special() const { return m_type != 0; }
-  void set( size_t size, size_t evtnum, int type ) {
-    m_bufsiz = size; m_evtnum = evtnum; m_type = type;
+  struct Event {
+    evbuf_ptr_t    buffer;    // Own buffer, obtained from the input file
+    const evbuf_t* data{};    // Event data: buffer or mapped file data
+    size_t         size{};
+    size_t         evtnum{};
+    int            type{};
+    [[nodiscard]] bool is_special() const { return type != 0; }
+  };
+
+  explicit EventBatch( size_t nmax ) : m_events(nmax), m_n(0), m_seq(0) {}
+  [[nodiscard]] size_t       size()       const { return m_n; }
+  [[nodiscard]] bool         full()       const { return m_n == m_events.size(); }
+  [[nodiscard]] size_t       seq()        const { return m_seq; }
+  [[nodiscard]] const Event& operator[]( size_t i ) const { return m_events[i]; }
+  [[nodiscard]] bool         is_special() const {
+    return any_of(m_events.begin(), m_events.begin()+m_n,
+                  []( const Event& ev ) { return ev.is_special(); });
   }
+  // Start a new, empty batch with sequence number 'seq'
+  void   reset( size_t seq ) { m_n = 0; m_seq = seq; }
+  Event& add() { assert(!full()); return m_events[m_n++]; }
 private:
-  evbuf_ptr_t m_buffer;
-  size_t m_bufsiz;
-  size_t m_evtnum;
-  int m_type;
+  vector<Event> m_events;
+  size_t m_n;      // Number of events in use
+  size_t m_seq;    // Batch sequence number, counting from 0
 };
 
-EventBuffer::EventBuffer() : m_buffer{}, m_bufsiz(0), m_evtnum(0), m_type(0)
-{
-  // For simplicity, use a fixed buffer size and the standard allocator
-  m_buffer = make_unique<evbuf_t[]>(MAX_EVTSIZE);
-}
-
-
 //-------------------------------------------------------------
 class EventReader {
 public:
-  EventReader( size_t max, const string& filename, unsigned int mark = 100 );
+  EventReader( size_t first, size_t max, const vector<string>& filenames,
+               size_t batch = 1,
+               DataFile::EReadMode read_mode = DataFile::kStdio,
+               size_t blocksize = ReadAhead::DEFAULT_BLOCKSIZE,
+               unsigned int nthreads = 0,
+               unsigned int mark = 100 );
   ~EventReader();
-  EventBuffer* operator()();
-  [[nodiscard]] EventBuffer* get() const { return m_cur; }
+  EventBatch* operator()();
+  [[nodiscard]] EventBatch* get() const { return m_cur; }
   [[nodiscard]] size_t evtnum() const { return m_count; }
+  [[nodiscard]] IOStats iostats() const { return m_inp.GetIOStats(); }
   [[nodiscard]] bool is_special() const;
   void print() const;
-  void push( EventBuffer* evt );
+  void push( EventBatch* evt );
 private:
-  DataFile m_inp;
+  FileChain m_inp;
+  size_t m_first;
   size_t m_max;
   size_t m_count;
+  size_t m_batch;      // Events per batch
+  size_t m_nbatch;     // Batches read
   size_t m_bufcount;
+  int    m_status;     // Status of the last read
   unsigned int m_mark;
-  EventBuffer* m_cur;  // Current event read
-  tbb::concurrent_queue<EventBuffer*> m_queue;
+  EventBatch* m_cur;   // Current batch read
+  tbb::concurrent_queue<EventBatch*> m_queue;
 
   void print_exit_info( int status ) const;
   void mark_progress() const;
 };
 
-EventReader::EventReader( size_t max, const string& filename, unsigned int mark )
-  : m_inp(filename)
+EventReader::EventReader( size_t first, size_t max,
+                          const vector<string>& filenames, size_t batch,
+                          DataFile::EReadMode read_mode, size_t blocksize,
+                          unsigned int nthreads, unsigned int mark )
+  : m_inp(filenames, read_mode, blocksize, nthreads)
+  , m_first(first > 0 ? first : 1)
   , m_max(max)
   , m_count(0)
+  , m_batch(batch > 0 ? batch : 1)
+  , m_nbatch(0)
   , m_bufcount(0)
+  , m_status(0)
   , m_mark(mark)
   , m_cur(nullptr)
 {
   if( m_inp.Open() != 0 ) {
     ostringstream ostr;
-    ostr << "Cannot open input " << filename;
+    ostr << "Cannot open input " << filenames.front();
     throw file_io_error(ostr.str());
   }
+  // Position at the first requested event. Use the event index if possible.
+  if( m_first > 1 ) {
+    if( m_inp.LoadIndex() != 0 && debug > 0 )
+      cout << "No complete event index for " << filenames.front()
+           << ", skipping " << m_first-1 << " events" << endl;
+    if( m_inp.SeekEvent(m_first) != 0 ) {
+      ostringstream ostr;
+      ostr << "Cannot find event " << m_first << " in " << filenames.front();
+      throw file_io_error(ostr.str());
+    }
+  }
 }
 
-EventBuffer* EventReader::operator()() {
-  if( !m_inp.IsOpen() )
+EventBatch* EventReader::operator()() {
+  if( !m_inp.IsOpen() || m_status != 0 || m_count >= m_max ) {
+    if( m_cur ) {
+      if( m_mark != 0 && m_count >= m_mark )
+        cout << endl;
+      print_exit_info(m_status);
+    }
     return m_cur = nullptr;
+  }
 
-  int st = 0;
-  if( m_count < m_max ) {
-    if( (st = m_inp.ReadEvent()) == 0 ) {
-      size_t evsiz = m_inp.GetEvSize();  // bytes
-      int type = 0; //TODO
-      ++m_count;
-      if( !m_queue.try_pop(m_cur) ) {
-        // If we're out of buffers, make a new one. This will quickly settle into a
-        // steady state as buffers are returned to the queue by the process() node.
-        m_cur = new EventBuffer;
-        ++m_bufcount;
-      }
-      m_cur->set(evsiz, m_count, type);
-      std::swap(m_cur->getptr(), m_inp.GetEvBuffer());
-      assert(m_cur->size() == evsiz);
-      mark_progress();
-
-      return m_cur;
+  if( !m_queue.try_pop(m_cur) ) {
+    // If we're out of batches, make a new one. This will quickly settle into a
+    // steady state as batches are returned to the queue by the process() node.
+    m_cur = new EventBatch(m_batch);
+    ++m_bufcount;
+  }
+  m_cur->reset(m_nbatch);
+  while( !m_cur->full() && m_count < m_max &&
+         (m_status = m_inp.ReadEvent()) == 0 ) {
+    auto& ev = m_cur->add();
+    ev.size = m_inp.GetEvSize();  // bytes
+    ev.type = 0; //TODO
+    ev.evtnum = m_first + m_count;
+    ++m_count;
+    if( m_inp.IsMapped() ) {
+      // Zero-copy: refer directly to the mapped file data
+      ev.data = m_inp.GetEvBufPtr();
+    } else {
+      // Take the event buffer. The input file enlarges the buffer it gets
+      // in exchange as needed for the next event.
+      std::swap(ev.buffer, m_inp.GetEvBuffer());
+      ev.data = ev.buffer.get();
     }
+    mark_progress();
+  }
+  if( m_cur->size() > 0 ) {
+    ++m_nbatch;
+    return m_cur;
   }
+
+  m_queue.push(m_cur);
   if( m_mark != 0 && m_count >= m_mark )
     cout << endl;
-
-  print_exit_info(st);
+  print_exit_info(m_status);
   return m_cur = nullptr;
 }
 
@@ -298,10 +420,10 @@ bool EventReader::is_special() const {
 
 void EventReader::print() const {
   cout << "Event reader: read/limit: " << m_count << "/" << m_max
-       << ", buffers allocated = " << m_bufcount << endl;
+       << ", batches allocated = " << m_bufcount << endl;
 }
 
-void EventReader::push( EventBuffer* evt ) {
+void EventReader::push( EventBatch* evt ) {
   m_queue.push(evt);
 }
 
@@ -341,41 +463,51 @@ EventReader::~EventReader() {
 
 
 //-------------------------------------------------------------
+// Writes the output chunks serialized by the analysis tasks
 class OutputWriter {
 public:
-  explicit OutputWriter( const string& odat_file );
-  Context* operator()( Context* ctxPtr );
+  OutputWriter( const string& odat_file,
+                std::shared_ptr<const OutputSchema> schema );
+  OutputChunk* operator()( OutputChunk* chunkPtr );
   ClockTime_t time() const { return m_time_spent; }
 private:
-  static void WriteHeader( ostrm_t& os, const Context* ctx );
-  static void WriteEvent( ostrm_t& os, const Context* ctx, bool do_header = false );
+  static void WriteEvent( ostrm_t& os, const OutputChunk* chunk );
   struct OutFile {
     OutFile() : m_last_written(0), m_header_written(false) {}
     int open( const string& odat_file ) {
       m_outp.open(odat_file, ios::out | ios::trunc | ios::binary);
       if( !m_outp )
         return 1;
-      if( compress_output > 0 )
-        m_ostrm.push(gzip_compressor());
-      m_ostrm.push(m_outp);
+      if( compress_output > 0 ) {
+        // Compress blocks of the output in parallel, with cfg.io_threads
+        m_compressor = std::make_unique<BlockCompressor>(m_outp,
+          compress_output == 2 ? BlockCompressor::kZstd : BlockCompressor::kGzip,
+          BlockCompressor::DEFAULT_BLOCKSIZE, cfg.io_threads);
+        m_ostrm.push(m_compressor->GetSink());
+      } else
+        m_ostrm.push(m_outp);
       return 0;
     }
     void close() {
       m_ostrm.reset();
+      m_compressor.reset();
       m_outp.close();
     }
     ofstream m_outp;
+    std::unique_ptr<BlockCompressor> m_compressor;  // Must outlive m_ostrm
     ostrm_t m_ostrm;
     size_t m_last_written;
     bool m_header_written;
   } __attribute__((aligned(128)));
 
   OutFile m_out_file;
+  std::shared_ptr<const OutputSchema> m_schema;  // For the header
   ClockTime_t m_time_spent;
 };
 
-OutputWriter::OutputWriter( const string& odat_file )
-  : m_time_spent() {
+OutputWriter::OutputWriter( const string& odat_file,
+                            std::shared_ptr<const OutputSchema> schema )
+  : m_schema(std::move(schema)), m_time_spent() {
   // Open output file and set up filter chain
   if( m_out_file.open(odat_file) != 0 ) {
     ostringstream ostr;
@@ -384,7 +516,7 @@ OutputWriter::OutputWriter( const string& odat_file )
   }
 }
 
-Context* OutputWriter::operator()( Context* ctxPtr ) {
+OutputChunk* OutputWriter::operator()( OutputChunk* chunkPtr ) {
   auto start = HighResClock::now();
   ofstream& outp = m_out_file.m_outp;
   ostrm_t& outs = m_out_file.m_ostrm;
@@ -394,40 +526,23 @@ Context* OutputWriter::operator()( Context* ctxPtr ) {
     goto skip;
 
   if( !m_out_file.m_header_written ) {
-    WriteHeader(outs, ctxPtr);
+    WriteHeader(outs, *m_schema);
     m_out_file.m_header_written = true;
   }
-  WriteEvent(outs, ctxPtr);
+  WriteEvent(outs, chunkPtr);
 skip:
   auto stop = HighResClock::now();
   m_time_spent += stop-start;  // TODO
-  return ctxPtr;
+  return chunkPtr;
 }
 
-void OutputWriter::WriteEvent( ostrm_t& os, const Context* const ctx, bool do_header ) {
-  // Write output file data (or header names)
-  for( const auto& var : ctx->outvars ) {
-    var->write(os, do_header);
+void OutputWriter::WriteEvent( ostrm_t& os, const OutputChunk* const chunk ) {
+  // Write the results of all events in the batch
+  WriteChunk(os, *chunk);
+  if( debug > 1 ) {
+    for( auto evnum : chunk->evnum )
+      cout << "Wrote nev = " << evnum << endl;
   }
-  if( debug > 1 && !do_header )
-    cout << "Wrote nev = " << ctx->nev << endl;
-}
-
-void OutputWriter::WriteHeader( ostrm_t& os, const Context* const ctx ) {
-  // Write output file header
-  // <N = number of variables> N*<variable type> N*<variable name C-string>
-  // where
-  //  <variable type> = TTTNNNNN,
-  // with
-  //  TTT   = type (0=int, 1=unsigned, 2=float/double, 3=C-string)
-  //  NNNNN = number of bytes
-  uint32_t nvars = ctx->outvars.size();
-  os.write(reinterpret_cast<const char*>(&nvars), sizeof(nvars));
-  for( const auto& var : ctx->outvars ) {
-    char type = var->GetType();
-    os.write(&type, sizeof(type));
-  }
-  WriteEvent(os, ctx, true);
 }
 
 //-------------------------------------------------------------
@@ -436,7 +551,7 @@ public:
   explicit ReadOneEvent( EventReader& evread )
   : m_evread(&evread)
   {}
-  EventBuffer* operator()(flow_control& fc) {
+  EventBatch* operator()(flow_control& fc) {
     auto* ev = (*m_evread)();
     if( !ev ||
         (mode == kPreserveSpecial && ev->is_special()) ) {
@@ -449,7 +564,32 @@ private:
   EventReader* m_evread;
 };
 
-using tuple_t = std::tuple<EventBuffer*, Context*>;
+// Inputs: events, free context, free output chunk
+using tuple_t = std::tuple<EventBatch*, Context*, OutputChunk*>;
+// Outputs: filled output chunk, context to be reused
+using enode_t = multifunction_node<tuple_t, std::tuple<OutputChunk*, Context*>>;
+
+//-------------------------------------------------------------
+// Decode and analyze the batch of events held by context 'ctx'
+static void AnalyzeBatch( Context& ctx )
+{
+  if( debug > 2 ) {
+    cout << "Loaded events " << ctx.evnum[0] << "-"
+         << ctx.evnum[ctx.nevents-1]
+         << ", context = " << ctx.id
+         << flush << endl;
+  }
+
+  ctx.Analyze();
+
+  // If requested, add random delay
+  if( delay_us > 0 ) {
+    int us = 0;
+    for( size_t i = 0; i < ctx.nevents; ++i )
+      us += intRand(0, delay_us);
+    std::this_thread::sleep_for(std::chrono::microseconds(2 * us));
+  }
+}
 
 //-------------------------------------------------------------
 class ProcessEvent {
@@ -457,48 +597,107 @@ public:
   explicit ProcessEvent( EventReader& evread )
   : m_evread(&evread)
   {}
-  Context* operator()(const tuple_t& t ) {
+  void operator()( const tuple_t& t, enode_t::output_ports_type& ports ) {
     auto start = HighResClock::now();
 
     auto* evtPtr = get<0>(t);
     auto* ctxPtr = get<1>(t);
+    auto* chunkPtr = get<2>(t);
     auto& ctx = *ctxPtr;
-    if( int status = ctx.evdata.Load(evtPtr->get()) ) {
-      cerr << "Decoding error = " << status
-           << " at event " << ctx.nev << endl;
-      goto skip;
-    }
-    ctx.iseq = ctx.nev = evtPtr->evtnum();
-    if( debug > 2 ) {
-      cout << "Loaded event " << ctx.nev
-           << ", context = " << ctx.id
-           << flush << endl;
+    // The events are not copied. The batch is returned to the reader
+    // only once they have been analyzed.
+    const auto& batch = *evtPtr;
+    ctx.nevents = batch.size();
+    for( size_t i = 0; i < batch.size(); ++i ) {
+      ctx.evptr[i] = batch[i].data;
+      ctx.evnum[i] = batch[i].evtnum;
     }
+    ctx.iseq = batch.seq();
+    AnalyzeBatch(ctx);
+    (*m_evread).push(evtPtr);
+    // Serialize the results here, so that the context can be reused
+    // right away and the serial output stage only appends bytes
+    ctx.Serialize(*chunkPtr);
 
-    for( auto& det: ctx.detectors ) {
-      det->Clear();
-      if( det->Decode(ctx.evdata) != 0 )
-        goto skip;
-      if( det->Analyze() != 0 )
-        goto skip;
-    }
+    auto stop = HighResClock::now();
+    ctx.m_time_spent += stop - start;
 
-    // If requested, add random delay
-    if( delay_us > 0 ) {
-      int us = intRand(0, delay_us);
-      std::this_thread::sleep_for(std::chrono::microseconds(2 * us));
+    get<1>(ports).try_put(ctxPtr);
+    get<0>(ports).try_put(chunkPtr);
+  }
+private:
+  EventReader* m_evread;
+};
+
+//-------------------------------------------------------------
+// Partitioned input: analysis tasks read their events themselves, each with
+// the Cursor it was handed. A Cursor is only used by one task at a time.
+using Cursor = PartitionedInput::Cursor;
+using ptuple_t = std::tuple<Cursor*, Context*, OutputChunk*>;
+// Outputs: filled output chunk, context to be reused, cursor to be reused,
+// unused output chunk
+using pnode_t = multifunction_node<ptuple_t,
+  std::tuple<OutputChunk*, Context*, Cursor*, OutputChunk*>>;
+
+class ProcessPartition {
+public:
+  ProcessPartition( atomic<size_t>& nread, unsigned int mark )
+    : m_nread(&nread), m_mark(mark)
+  {}
+  void operator()( const ptuple_t& t, pnode_t::output_ports_type& ports ) {
+    auto* cursor = get<0>(t);
+    auto* ctxPtr = get<1>(t);
+    auto* chunkPtr = get<2>(t);
+
+    auto& ctx = *ctxPtr;
+    int status = ctx.ReadBatch(*cursor);
+    if( status > 0 )
+      cerr << "Reading input ended with error " << status << endl;
+    if( ctx.nevents == 0 ) {
+      get<1>(ports).try_put(ctxPtr);
+      get<3>(ports).try_put(chunkPtr);
+      return;
     }
+    auto start = HighResClock::now();
+    // In strict ordering mode, batches hold one event, see get_args()
+    ctx.iseq = ctx.evnum[0] - cfg.first_event;
+    for( size_t i = 0; i < ctx.nevents; ++i )
+      mark_progress(++(*m_nread));
 
-  skip: //TODO: add error status to context, let output skip bad results
-    (*m_evread).push(evtPtr);
+    AnalyzeBatch(ctx);
+    ctx.Serialize(*chunkPtr);
 
     auto stop = HighResClock::now();
     ctx.m_time_spent += stop - start;
 
-    return ctxPtr;
+    // Return the cursor before the context and the chunk. In strict ordering
+    // mode, this guarantees that the cursor holding the next event in
+    // sequence is available whenever a context and a chunk are freed.
+    if( status == 0 && cursor->HasNext() )
+      get<2>(ports).try_put(cursor);
+    get<1>(ports).try_put(ctxPtr);
+    get<0>(ports).try_put(chunkPtr);
   }
 private:
-  EventReader* m_evread;
+  atomic<size_t>* m_nread;
+  unsigned int m_mark;
+
+  void mark_progress( size_t nev ) const {
+    if( debug > 1 )
+      cout << "Event " << nev << endl;
+    else if( m_mark != 0 && (nev % m_mark) == 0 ) {
+      if( nev > m_mark )
+        cout << "..";
+      cout << nev << flush;
+    }
+  }
+};
+
+// Hand out the cursor with the lowest next event number first
+struct CursorOrder {
+  bool operator()( const Cursor* a, const Cursor* b ) const {
+    return a->GetNextEvnum() > b->GetNextEvnum();
+  }
 };
 
 //-------------------------------------------------------------
@@ -507,17 +706,15 @@ public:
   explicit OutputEvent( OutputWriter& outw )
     : m_out(&outw)
   {}
-  Context* operator()( Context* ctxPtr ) {
+  OutputChunk* operator()( OutputChunk* chunkPtr ) {
     if( debug > 2 ) {
-      cout << "Output " << setw(5) << ctxPtr->nev;
-      if( ctxPtr->evdata.IsSyncEvent() )
-        cout << " S ";
-      else
-        cout << "   ";
-      cout << ", context = " << ctxPtr->id
-           << flush << endl;
+      for( auto evnum : chunkPtr->evnum ) {
+        cout << "Output " << setw(5) << evnum
+             << ", batch = " << chunkPtr->iseq
+             << flush << endl;
+      }
     }
-    auto* ret = (*m_out)(ctxPtr);
+    auto* ret = (*m_out)(chunkPtr);
     return ret;
   }
 private:
@@ -537,8 +734,9 @@ public:
     init_duration = HighResClock::now() - init_start;
   }
   void stop( const vector<unique_ptr<Context>>& contexts,
-             const OutputWriter& outw ) {
+             const OutputWriter& outw, const IOStats& io ) {
     run_duration = HighResClock::now() - start;
+    input_stats = io;
     analysis_realtime_sum =
       std::accumulate(contexts.begin(), contexts.end(), ClockTime_t(),
                       []( const ClockTime_t& val, const auto& ctx ) -> ClockTime_t {
@@ -557,6 +755,9 @@ public:
     cout << "Init:      " << init_duration.count()         << " ms" << endl;
     cout << "Analysis:  " << analysis_realtime_sum.count() << " ms" << endl;
     cout << "Output:    " << output_realtime_sum.count()   << " ms" << endl;
+    cout << "Input:     " << input_stats.bytes / 1e6 << " MB, "
+         << input_stats.bytes / 1e3 / run_duration.count() << " MB/s, "
+         << "stalled " << input_stats.stall.count() << " ms" << endl;
     cout << "Total CPU: " << cpu_usage.count()             << " ms" << endl;
     cout << "Real:      " << run_duration.count()          << " ms" << endl;
   };
@@ -569,6 +770,7 @@ private:
   ClockTime_t analysis_realtime_sum{};
   ClockTime_t output_realtime_sum{};
   ClockTime_t cpu_usage{};
+  IOStats input_stats{};
 };
 
 //-------------------------------------------------------------
@@ -603,9 +805,8 @@ unsigned int SetNThreads()
 //-------------------------------------------------------------
 int MakeDets( detlst_t& detlst )
 {
-  detlst.push_back( make_unique<DetectorTypeA>("detA", 1));
-  detlst.push_back( make_unique<DetectorTypeB>("detB", 2));
-  detlst.push_back( make_unique<DetectorTypeC>("detC", 3));
+  if( MakeDetectors(cfg.det_file, detlst) != 0 )
+    return 1;
 
   // Initialize shared analysis object data
   for( auto& det: detlst ) {
@@ -651,6 +852,9 @@ int main( int argc, char* const* argv )
   auto nthreads = SetNThreads();
   if( debug > 0 )
     cout << "Initializing " << nthreads << " analysis threads" << endl;
+  // Compressed input and output each get threads for half of -j, so that
+  // with both they use about as many threads as the analysis
+  cfg.io_threads = max(nthreads/2, 1u);
 
   if( ReadDatabase() < 0 )
     return 1;  // error message already printed
@@ -664,46 +868,136 @@ int main( int argc, char* const* argv )
   vector<unique_ptr<Context>> contexts;
   if( MakeContexts( contexts, nthreads, gDets ) != 0 )
     return 2;
-  gDets.clear();  // No need to keep the prototype detector objects around
+  // The prototypes are kept for reporting on their shared data at the end
+
+  // Partitioned input, if requested
+  unique_ptr<PartitionedInput> partitions;
+  if( cfg.nev_chunk > 0 || cfg.parallel_files ) {
+    if( mode == kPreserveSpecial ) {
+      cerr << "Partitioned input does not support -e sync, "
+           << "reading input serially" << endl;
+    } else {
+      partitions = make_unique<PartitionedInput>(
+        cfg.input_files, cfg.read_mode, cfg.first_event, cfg.nev_max,
+        cfg.nev_chunk);
+      if( partitions->Init() != 0 )
+        return 2;
+    }
+  }
 
   // Set up TBB flow graph nodes
   tbb::flow::graph g;
-  join_node < tuple_t, reserving > j(g);
   buffer_node<Context*> free_ctx(g);
 
-  // Input
-  EventReader eventReader(cfg.nev_max, cfg.input_file);
-  input_node<EventBuffer*>
-    read_input(g, ReadOneEvent(eventReader));
-
-  // Parallel processing of events in flight
-  function_node<tuple_t, Context*>
-    process(g, unlimited, ProcessEvent(eventReader));
+  // Output chunks. The analysis tasks serialize their results into these
+  // and release their Context right away. The number of chunks bounds the
+  // backlog of the output stage.
+  vector<unique_ptr<OutputChunk>> chunks;
+  buffer_node<OutputChunk*> free_chunk(g);
 
   // Sequential output
-  OutputWriter outputWriter(cfg.output_file);
-  function_node<Context*, Context*>
+  OutputWriter outputWriter(cfg.output_file, contexts.front()->schema);
+  function_node<OutputChunk*, OutputChunk*>
     out(g, serial, OutputEvent(outputWriter));
 
   // Sequencer for event ordering
-  sequencer_node<Context*> seq(g, []( const Context* ctx ) -> size_t {
-    return ctx->nev - 1;   // Sequence must start at 0
+  sequencer_node<OutputChunk*> seq(g, []( const OutputChunk* chunk ) -> size_t {
+    return chunk->iseq;   // Sequence must start at 0
   });
+  if( mode == kOrdered )
+    make_edge(seq, out);
+  make_edge(out, free_chunk);
+  for( decltype(nthreads) i = 0; i < 2*nthreads; ++i )
+    chunks.push_back(make_unique<OutputChunk>());
+
+  if( partitions ) {
+    // One cursor per thread. Each processing task reads its own event.
+    vector<unique_ptr<Cursor>> cursors;
+    priority_queue_node<Cursor*, CursorOrder> free_cursor(g);
+    join_node<ptuple_t, reserving> j(g);
+    atomic<size_t> nread{0};
+    pnode_t process(g, unlimited, ProcessPartition(nread, cfg.mark));
+
+    make_edge(free_cursor, input_port<0>(j));
+    make_edge(free_ctx, input_port<1>(j));
+    make_edge(free_chunk, input_port<2>(j));
+    make_edge(j, process);
+    if( mode == kOrdered )
+      make_edge(output_port<0>(process), seq);
+    else
+      make_edge(output_port<0>(process), out);
+    make_edge(output_port<1>(process), free_ctx);
+    make_edge(output_port<2>(process), free_cursor);
+    make_edge(output_port<3>(process), free_chunk);
+
+    for( decltype(nthreads) i = 0; i < nthreads; ++i ) {
+      cursors.push_back(make_unique<Cursor>(*partitions));
+      if( cursors.back()->HasNext() )
+        free_cursor.try_put(cursors.back().get());
+    }
+    for( auto& ctxPtr: contexts ) {
+      free_ctx.try_put(ctxPtr.get());
+    }
+    for( auto& chunkPtr: chunks ) {
+      free_chunk.try_put(chunkPtr.get());
+    }
+
+    timer.stop_init();
+
+    if( debug > 0 )
+      cout << "Starting event loop, nev_max = " << cfg.nev_max
+           << ", " << partitions->GetNevents() << " events in chunks of "
+           << (cfg.nev_chunk > 0 ? to_string(cfg.nev_chunk) : "one file")
+           << endl;
+
+    g.wait_for_all();
+
+    if( cfg.mark != 0 && nread >= cfg.mark )
+      cout << endl;
+    if( debug > 0 ) {
+      cout << "Read " << nread << " events" << endl;
+      BufferPool::Instance().Print();
+    }
+
+    // Total wall times
+    IOStats iostats;
+    for( const auto& cursor : cursors )
+      iostats += cursor->GetIOStats();
+    timer.stop(contexts, outputWriter, iostats);
+    timer.print();
+    PrintCacheStats(gDets);
+
+    return 0;
+  }
+
+  join_node < tuple_t, reserving > j(g);
+
+  // Input
+  EventReader eventReader(cfg.first_event, cfg.nev_max, cfg.input_files,
+                          cfg.batch_size, cfg.read_mode, cfg.read_block_size,
+                          cfg.io_threads);
+  input_node<EventBatch*>
+    read_input(g, ReadOneEvent(eventReader));
+
+  // Parallel processing of events in flight
+  enode_t process(g, unlimited, ProcessEvent(eventReader));
 
   // Build the graph
   make_edge(free_ctx, input_port<1>(j));
+  make_edge(free_chunk, input_port<2>(j));
   make_edge(j, process);
-  if( mode == kOrdered ) {
-    make_edge(process, seq);
-    make_edge(seq, out);
-  } else {
-    make_edge(process, out);
-  }
-  make_edge(out, free_ctx);
+  if( mode == kOrdered )
+    make_edge(output_port<0>(process), seq);
+  else
+    make_edge(output_port<0>(process), out);
+  make_edge(output_port<1>(process), free_ctx);
 
   for( auto& ctxPtr: contexts ) {
     free_ctx.try_put(ctxPtr.get());
   }
+  for( auto& chunkPtr: chunks ) {
+    free_chunk.try_put(chunkPtr.get());
+  }
 
   timer.stop_init();
 
@@ -716,7 +1010,7 @@ int main( int argc, char* const* argv )
     g.wait_for_all();
 
   } else {
-    queue_node<EventBuffer*> evtqueue(g);
+    queue_node<EventBatch*> evtqueue(g);
     make_edge(evtqueue, input_port<0>(j));
     make_edge(read_input, input_port<0>(j));
     for( ;; ) {
@@ -731,12 +1025,15 @@ int main( int argc, char* const* argv )
     }
   }
 
-  if( debug > 0 )
+  if( debug > 0 ) {
     eventReader.print();
+    BufferPool::Instance().Print();
+  }
 
   // Total wall times
-  timer.stop(contexts, outputWriter);
+  timer.stop(contexts, outputWriter, eventReader.iostats());
   timer.print();
+  PrintCacheStats(gDets);
 
   return 0;
 }
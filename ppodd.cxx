@@ -2,15 +2,16 @@
 
 #include "Podd.h"
 #include "DataFile.h"
+#include "Detector.h"
 //#include "Decoder.h"
-#include "DetectorTypeA.h"
-#include "DetectorTypeB.h"
-#include "DetectorTypeC.h"
 #include "Output.h"
 #include "Util.h"
 #include "ThreadPool.hpp"
 #include "Context.h"
 #include "Database.h"
+#include "PartitionedInput.h"
+#include "FileChain.h"
+#include "BlockCompressor.h"
 
 #include <iostream>
 #include <unistd.h>
@@ -22,11 +23,12 @@
 #include <ctime>
 #include <cstdlib>
 #include <stdexcept>
+#include <cstring>
+#include <atomic>
 
 // For output module
 #include <fstream>
 //#include <boost/iostreams/filtering_stream.hpp>
-#include <boost/iostreams/filter/gzip.hpp>
 
 //#define OUTPUT_POOL
 
@@ -53,58 +55,131 @@ static bool allow_sync_events = false;
 static mutex time_sum_mutex;
 static ClockTime_t analysis_realtime_sum;
 static ClockTime_t output_realtime_sum;
+static atomic<size_t> nev_partitioned{0};  // Events read by PartitionWorkers
+static IOStats input_stats;                // Summed over all input files
+
+static void mark_progress( size_t nev );
+
+// Decode and analyze the batch of events held by 'ctx'
+template<typename Context_t>
+static void AnalyzeBatch( Context_t& ctx )
+{
+  // Process all defined analysis objects
+  ctx.Analyze();
+
+  // If requested, add random delay
+  if( delay_us > 0 ) {
+    int us = 0;
+    for( size_t i = 0; i < ctx.nevents; ++i )
+      us += intRand(0, delay_us);
+    std::this_thread::sleep_for(std::chrono::microseconds(2 * us));
+  }
+}
+
+// Serialize the results of the batch held by 'ctx' into its output chunk,
+// return the context to 'freeQueue' and pass the chunk to the output thread
+template<typename Context_t>
+static void FinishBatch( std::unique_ptr<Context_t> ctxPtr,
+                         ConcurrentQueue<Context_t>& freeQueue,
+                         QueuingThreadPool<Context_t, OutputChunk>* pool )
+{
+  auto chunkPtr = std::move(ctxPtr->output);
+  ctxPtr->Serialize(*chunkPtr);
+#ifdef EVTORDER
+  if( order_events )
+    ctxPtr->UnmarkActive();
+#endif
+  freeQueue.push( std::move(ctxPtr) );
+  pool->push_result( std::move(chunkPtr) );
+}
 
 template<typename Context_t>
 class AnalysisWorker {
 private:
+  ConcurrentQueue<Context_t>* m_freeQueue;
   ClockTime_t m_time_spent;
 
 public:
-  AnalysisWorker() : m_time_spent{} {}
+  explicit AnalysisWorker( ConcurrentQueue<Context_t>& freeQueue )
+    : m_freeQueue(&freeQueue), m_time_spent{} {}
 
-  void run( QueuingThreadPool<Context_t>* pool ) {
+  void run( QueuingThreadPool<Context_t, OutputChunk>* pool ) {
     while( auto ctxPtr = pool->pop_work() ) {
       auto start = HighResClock::now();
-      Context_t& ctx = *ctxPtr;
+      AnalyzeBatch(*ctxPtr);
+      FinishBatch(std::move(ctxPtr), *m_freeQueue, pool);
+      auto stop = HighResClock::now();
+      m_time_spent += stop-start;
+    }
 
-      // Process all defined analysis objects
-      if( int status = ctx.evdata.Load(ctx.evbuffer.get()) ) {
-        cerr << "Decoding error = " << status
-             << " at event " << ctx.nev << endl;
-        goto skip;
+    std::lock_guard time_lock(time_sum_mutex);
+    analysis_realtime_sum += m_time_spent;
+  }
+};
+
+// Analysis worker for partitioned input. Each thread reads its own events
+// with its own cursor into the input file, so reading scales with the
+// number of threads. Free Contexts and output chunks are taken directly
+// from the free queues; the pool's work queue is not used.
+template<typename Context_t>
+class PartitionWorker {
+private:
+  PartitionedInput* m_input;
+  ConcurrentQueue<Context_t>* m_freeQueue;
+  ConcurrentQueue<OutputChunk>* m_freeChunks;
+  ClockTime_t m_time_spent;
+
+public:
+  PartitionWorker( PartitionedInput& input, ConcurrentQueue<Context_t>& freeQueue,
+                   ConcurrentQueue<OutputChunk>& freeChunks )
+    : m_input(&input), m_freeQueue(&freeQueue), m_freeChunks(&freeChunks),
+      m_time_spent{} {}
+
+  void run( QueuingThreadPool<Context_t, OutputChunk>* pool ) {
+    PartitionedInput::Cursor cursor(*m_input);
+    int status = 0;
+    while( status == 0 ) {
+      auto ctxPtr = m_freeQueue->next();
+      auto start = HighResClock::now();
+      Context_t& ctx = *ctxPtr;
+      status = ctx.ReadBatch(cursor);
+      if( ctx.nevents == 0 ) {
+        m_freeQueue->push(std::move(ctxPtr));
+        break;
       }
-      for( auto& det : ctx.detectors ) {
-        det->Clear();
-        if( det->Decode(ctx.evdata) != 0 )
-          goto skip;
-        if( det->Analyze() != 0 )
-          goto skip;
+      for( size_t i = 0; i < ctx.nevents; ++i ) {
+        if( debug > 1 )
+          cout << "Event " << ctx.evnum[i] << endl;
+        else
+          mark_progress(++nev_partitioned);
       }
 
-      // If requested, add random delay
-      if( delay_us > 0 ) {
-        int us = intRand(0, delay_us);
-        std::this_thread::sleep_for(std::chrono::microseconds(2 * us));
-      }
+      AnalyzeBatch(ctx);
+      ctx.output = m_freeChunks->next();
+      FinishBatch(std::move(ctxPtr), *m_freeQueue, pool);
 
-     skip: //TODO: add error status to context, let output skip bad results
       auto stop = HighResClock::now();
       m_time_spent += stop-start;
-      pool->push_result( std::move(ctxPtr) );
     }
+    if( status > 0 )
+      cerr << "Reading input ended with error " << status << endl;
 
     std::lock_guard time_lock(time_sum_mutex);
     analysis_realtime_sum += m_time_spent;
+    input_stats += cursor.GetIOStats();
   }
 };
 
+// Writes the output chunks serialized by the analysis threads
 template<typename Context_t>
 class OutputWorker {
 private:
-  // Queue for finished contexts
-  ConcurrentQueue<Context_t>& fFreeQueue;
+  // Queue for written chunks
+  ConcurrentQueue<OutputChunk>& fFreeChunks;
+  // Definitions of the output records, for the header
+  std::shared_ptr<const OutputSchema> fSchema;
   // Temporary storage for event ordering
-  std::map<size_t, std::unique_ptr<Context_t>> fBuffer;
+  std::map<size_t, std::unique_ptr<OutputChunk>> fBuffer;
   ClockTime_t m_time_spent;
 
   // Data shared between all output threads
@@ -115,17 +190,24 @@ private:
       outp.open(odat_file, ios::out | ios::trunc | ios::binary);
       if( !outp )
         return 1;
-      if( compress_output > 0 )
-        outs.push(gzip_compressor());
-      outs.push(outp);
+      if( compress_output > 0 ) {
+        // Compress blocks of the output in parallel, with cfg.io_threads
+        compressor = std::make_unique<BlockCompressor>(outp,
+          compress_output == 2 ? BlockCompressor::kZstd : BlockCompressor::kGzip,
+          BlockCompressor::DEFAULT_BLOCKSIZE, cfg.io_threads);
+        outs.push(compressor->GetSink());
+      } else
+        outs.push(outp);
       return 0;
     }
     void close() {
       outs.reset();
+      compressor.reset();
       outp.close();
     }
     mutex output_mutex;
     ofstream outp;
+    std::unique_ptr<BlockCompressor> compressor;  // Must outlive outs
     ostrm_t outs;
     size_t fLastWritten;
     bool fHeaderWritten;
@@ -134,34 +216,20 @@ private:
   // Singleton shared data blob
   static inline SharedData fShared {};
 
-  void WriteEvent( ostrm_t& os, Context_t* ctx, bool do_header = false ) {
-    // Write output file data (or header names)
-    for( auto& var : ctx->outvars ) {
-      var->write(os, do_header);
+  void WriteEvent( ostrm_t& os, const OutputChunk* chunk ) {
+    // Write the results of all events in the batch
+    WriteChunk(os, *chunk);
+    if( debug > 1 ) {
+      for( auto evnum : chunk->evnum )
+        cout << "Wrote nev = " << evnum << endl;
     }
-    if( debug > 1 && !do_header )
-      cout << "Wrote nev = " << ctx->nev << endl;
-  }
-  void WriteHeader( ostrm_t& os, Context_t* ctx ) {
-    // Write output file header
-    // <N = number of variables> N*<variable typ£££e> N*<variable name C-string>
-    // where
-    //  <variable type> = TTTNNNNN,
-    // with
-    //  TTT   = type (0=int, 1=unsigned, 2=float/double, 3=C-string)
-    //  NNNNN = number of bytes
-    uint32_t nvars = ctx->outvars.size();
-    os.write(reinterpret_cast<const char*>(&nvars), sizeof(nvars));
-    for( auto& var : ctx->outvars ) {
-      char type = var->GetType();
-      os.write(&type, sizeof(type));
-    }
-    WriteEvent(os, ctx, true);
   }
 
 public:
-  OutputWorker( const string& odat_file, ConcurrentQueue<Context_t>& freeQueue )
-          : fFreeQueue(freeQueue), fBuffer{}, m_time_spent{} {
+  OutputWorker( const string& odat_file, ConcurrentQueue<OutputChunk>& freeChunks,
+                std::shared_ptr<const OutputSchema> schema )
+          : fFreeChunks(freeChunks), fSchema(std::move(schema)), fBuffer{},
+            m_time_spent{} {
     // Open output file and set up filter chain
     if( fShared.open(odat_file) != 0 ) {
       cerr << "Error opening output data file " << odat_file << endl;
@@ -170,18 +238,16 @@ public:
   }
 
   OutputWorker( const OutputWorker& rhs )
-          : fFreeQueue(rhs.fFreeQueue), fBuffer{}, m_time_spent{} {
+          : fFreeChunks(rhs.fFreeChunks), fSchema(rhs.fSchema), fBuffer{},
+            m_time_spent{} {
     // Copy constructor. Called when used in std::thread
   }
 
   ~OutputWorker() = default;
 
-  void run( QueuingThreadPool<Context_t>* pool ) {
-    while( auto ctxPtr = pool->pop_result() ) {
+  void run( QueuingThreadPool<Context_t, OutputChunk>* pool ) {
+    while( auto chunkPtr = pool->pop_result() ) {
       auto start = HighResClock::now();
-#ifdef EVTORDER
-      Context_t& ctx = *ctxPtr;
-#endif
       ofstream& outp = fShared.outp;
       ostrm_t& outs = fShared.outs;
 
@@ -191,7 +257,7 @@ public:
         goto skip;
 
       if( !fShared.fHeaderWritten ) {
-        WriteHeader(outs, ctxPtr.get());
+        WriteHeader(outs, *fSchema);
         fShared.fHeaderWritten = true;
       }
 #ifdef EVTORDER
@@ -199,40 +265,35 @@ public:
         // Wait for next event in sequence before writing
         // FIXME: I don't think this works with > 1 thread
         if( auto& last_written = fShared.fLastWritten;
-                ctx.iseq == last_written + 1 ) {
-          WriteEvent(outs, ctxPtr.get());
+                chunkPtr->iseq == last_written + 1 ) {
+          WriteEvent(outs, chunkPtr.get());
           ++last_written;
-          ctx.UnmarkActive();
-          fFreeQueue.push(std::move(ctxPtr));
+          fFreeChunks.push(std::move(chunkPtr));
           // Check if some or all of the buffer can be written now, too
           for( auto it = fBuffer.begin(), jt = it;
                it != fBuffer.end() && (*it).first == last_written + 1; it = jt ) {
             ++jt;
-            auto bufCtxPtr = std::move( (*it).second );
-            WriteEvent(outs, bufCtxPtr.get());
+            auto bufChunkPtr = std::move( (*it).second );
+            WriteEvent(outs, bufChunkPtr.get());
             ++last_written;
-            bufCtxPtr->UnmarkActive();
-            fFreeQueue.push( std::move(bufCtxPtr) );
+            fFreeChunks.push( std::move(bufChunkPtr) );
             fBuffer.erase(it);
           }
         } else {
-          // Buffer out-of-order events, sorted by iseq
-          fBuffer.emplace(ctx.iseq, std::move(ctxPtr));
+          // Buffer out-of-order batches, sorted by iseq
+          auto iseq = chunkPtr->iseq;
+          fBuffer.emplace(iseq, std::move(chunkPtr));
           //TODO: error check
           //TODO: deal with skipped events!
         }
       } else
 #endif
       {
-        WriteEvent(outs, ctxPtr.get());
+        WriteEvent(outs, chunkPtr.get());
        skip:
-#ifdef EVTORDER
-        if( order_events )
-          ctx.UnmarkActive();
-#endif
         auto stop = HighResClock::now();
         m_time_spent += stop-start;
-        fFreeQueue.push( std::move(ctxPtr) );
+        fFreeChunks.push( std::move(chunkPtr) );
       }
     }
     std::lock_guard time_lock(time_sum_mutex);
@@ -264,7 +325,7 @@ void Config::default_names() {
 }
 
 static void usage() {
-  cerr << "Usage: " << prgname << " [options] input_file.dat" << endl
+  cerr << "Usage: " << prgname << " [options] input_file.dat ..." << endl
        << "where options are:" << endl
        << " [ -c odef_file ]\tread output definitions from odef_file"
        << " (default = input_file.odef)" << endl
@@ -272,15 +333,26 @@ static void usage() {
        << " (default = input_file.odat)" << endl
        << " [ -b db_file ]\t\tuse database file db_file"
        << " (default = input_file.db)" << endl
+       << " [ -l det_file ]\t\tcreate the detectors listed in det_file"
+       << " (default = built-in set)" << endl
        << " [ -d debug_level ]\tset debug level" << endl
        << " [ -n nev_max ]\t\tset max number of events" << endl
+       << " [ -s first_event ]\tstart at event number first_event (default = 1)" << endl
        << " [ -j nthreads ]\tcreate at most nthreads (default = n_cpus)" << endl
        << " [ -y us ]\t\tAdd us microseconds average random delay per event" << endl
+       << " [ -g nev_batch ]\tAnalyze events in batches of nev_batch (default = 16)" << endl
+       << " [ -t us ]\t\tRun detectors taking at least us microseconds per batch" << endl
+       << "\t\t\tconcurrently (default = off)" << endl
 #ifdef EVTORDER
-       << " [ -e (sync|strict) ]\tPreserve event order" << endl
+       << " [ -e (sync|strict) ]\tPreserve event order (analyzes single events)" << endl
 #endif
        << " [ -m interval ]\tMark progress at given intervals" << endl
+       << " [ -r (stdio|mmap|prefetch) ] Method for reading input (default = stdio)" << endl
+       << " [ -B block_MB ]\tBlock size for -r prefetch (default = 8)" << endl
+       << " [ -p nev_chunk ]\tRead input in parallel, in chunks of nev_chunk events" << endl
+       << " [ -F ]\t\t\tRead input files in parallel, one reader per file" << endl
        << " [ -z ]\t\t\tCompress output with gzip" << endl
+       << " [ -Z ]\t\t\tCompress output with zstd" << endl
        << " [ -h ]\t\t\tPrint this help message" << endl;
   exit(255);
 }
@@ -296,7 +368,7 @@ void get_args(int argc, char* const* argv )
 
   try {
     int opt;
-    while( (opt = getopt(argc, argv, "b:c:d:n:o:j:y:e:m:zmh")) != -1 ) {
+    while( (opt = getopt(argc, argv, "b:c:d:l:n:o:j:y:e:g:m:p:r:s:t:B:FzZmh")) != -1 ) {
       switch( opt ) {
         case 'b':
           cfg.db_file = optarg;
@@ -304,12 +376,29 @@ void get_args(int argc, char* const* argv )
         case 'c':
           cfg.odef_file = optarg;
           break;
+        case 'l':
+          cfg.det_file = optarg;
+          break;
         case 'd':
           debug = stoi(optarg);
           break;
         case 'n':
           cfg.nev_max = stoi(optarg);
           break;
+        case 'p':
+          cfg.nev_chunk = stoul(optarg);
+          break;
+        case 'F':
+          cfg.parallel_files = true;
+          break;
+        case 'B':
+          cfg.read_block_size = stoul(optarg) * 1024 * 1024;
+          break;
+        case 's':
+          cfg.first_event = stoul(optarg);
+          if( cfg.first_event == 0 )
+            cfg.first_event = 1;
+          break;
         case 'o':
           cfg.output_file = optarg;
           break;
@@ -327,6 +416,14 @@ void get_args(int argc, char* const* argv )
         case 'y':
           delay_us = stoi(optarg);
           break;
+        case 'g':
+          cfg.batch_size = stoul(optarg);
+          if( cfg.batch_size == 0 )
+            cfg.batch_size = 1;
+          break;
+        case 't':
+          cfg.task_threshold = stod(optarg);
+          break;
 #ifdef EVTORDER
           case 'e':
           if( !optarg ) usage();
@@ -343,9 +440,23 @@ void get_args(int argc, char* const* argv )
         case 'z':
           compress_output = 1;
           break;
+        case 'Z':
+          compress_output = 2;
+          break;
         case 'm':
           cfg.mark = stoi(optarg);
           break;
+        case 'r':
+          if( !strcmp(optarg, "stdio") ) {
+            cfg.read_mode = DataFile::kStdio;
+          } else if( !strcmp(optarg, "mmap") ) {
+            cfg.read_mode = DataFile::kMmap;
+          } else if( !strcmp(optarg, "prefetch") ) {
+            cfg.read_mode = DataFile::kPrefetch;
+          } else {
+            usage();
+          }
+          break;
         case 'h':
         default:
           usage();
@@ -361,8 +472,16 @@ void get_args(int argc, char* const* argv )
     cerr << "Input file name missing" << endl;
     usage();
   }
-  cfg.input_file = argv[optind];
+  // Several input files, or wildcard patterns, form one stream of events
+  for( int i = optind; i < argc; ++i )
+    ExpandFileNames(argv[i], cfg.input_files);
+  cfg.input_file = cfg.input_files.front();
   cfg.default_names();
+#ifdef EVTORDER
+  // Sync events must be seen by the main loop one at a time
+  if( allow_sync_events )
+    cfg.batch_size = 1;
+#endif
 }
 
 static void mark_progress( size_t nev )
@@ -384,10 +503,17 @@ int main( int argc, char* const* argv )
 
   if( debug > 0 ) {
     cout << "input_file        = " << cfg.input_file    << endl;
+    if( cfg.input_files.size() > 1 )
+      cout << "input_files       = " << cfg.input_files.size() << " files" << endl;
     cout << "db_file           = " << cfg.db_file       << endl;
+    cout << "det_file          = " << cfg.det_file      << endl;
     cout << "odef_file         = " << cfg.odef_file     << endl;
     cout << "output_file       = " << cfg.output_file   << endl;
     cout << "compress_output   = " << compress_output   << endl;
+    cout << "read_mode         = " << cfg.read_mode     << endl;
+    cout << "read_block_size   = " << cfg.read_block_size << endl;
+    cout << "batch_size        = " << cfg.batch_size    << endl;
+    cout << "task_threshold    = " << cfg.task_threshold << endl;
 #ifdef EVTORDER
     cout << "order_events      = " << order_events      << endl;
     cout << "allow_sync_events = " << allow_sync_events << endl;
@@ -408,11 +534,18 @@ int main( int argc, char* const* argv )
   auto start = HighResClock::now();
   auto init_start = HighResClock::now();
 
-  // Set up analysis objects
+  // Set up analysis objects. These prototypes are kept for reporting on
+  // their shared data at the end.
   detlst_t gDets;
-  gDets.push_back( make_unique<DetectorTypeA>("detA", 1));
-  gDets.push_back( make_unique<DetectorTypeB>("detB", 2));
-  gDets.push_back( make_unique<DetectorTypeC>("detC", 3));
+  if( MakeDetectors(cfg.det_file, gDets) != 0 )
+    return 1;
+
+  // Initialize shared analysis object data
+  for( auto& det: gDets ) {
+    if( det->Init(true) != 0 )
+      // Die on failure to initialize (database read error)
+      return 1;
+  }
 
   // Set up thread contexts. Copy analysis objects.
   unsigned int ncores = GetThreadCount(), nthreads = cfg.nthreads;
@@ -422,15 +555,27 @@ int main( int argc, char* const* argv )
     nthreads = (ncores > 1) ? ncores - 1 : 1;
   if( debug > 0 )
     cout << "Initializing " << nthreads << " analysis threads" << endl;
+  // Compressed input and output each get threads for half of -j, so that
+  // with both they use about as many threads as the analysis
+  cfg.io_threads = max(nthreads/2, 1u);
+
+  // Pool for running the detectors of a batch concurrently, see
+  // Context::Analyze. Analysis threads waiting for their tasks run queued
+  // tasks themselves, so the pool only needs to use the remaining cores.
+  unique_ptr<TaskPool> taskPool;
+  if( cfg.task_threshold >= 0 )
+    taskPool = make_unique<TaskPool>(ncores > nthreads ? ncores - nthreads : 1);
 
   using Queue_t = ConcurrentQueue<Context>;
   Queue_t freeQueue;
+  shared_ptr<const OutputSchema> schema;
   for( unsigned int i=0; i<nthreads; ++i ) {
     // Make new context
     auto ctxPtr = make_unique<Context>();
     Context& ctx = *ctxPtr;
     // Clone detectors into each new context
     CopyContainer(gDets, ctx.detectors);
+    ctx.task_pool = taskPool.get();
     // Init if necessary
     //TODO: split up Init:
     // (1) Read database and all other related things, do before cloning
@@ -441,29 +586,81 @@ int main( int argc, char* const* argv )
         // Die on failure to initialize (usually database read error)
         return 1;
     }
+    schema = ctx.schema;
     freeQueue.push( std::move(ctxPtr) );
   }
-  gDets.clear();  // No need to keep the prototype detector objects around
+  // Output chunks. The analysis threads serialize their results into these
+  // and release their Context right away. The number of chunks bounds the
+  // backlog of the output thread.
+  ConcurrentQueue<OutputChunk> freeChunks;
+  for( unsigned int i=0; i<2*nthreads; ++i )
+    freeChunks.push( make_unique<OutputChunk>() );
 
   // if( debug > 1 )
   //   PrintVarList(gVars);
 
   // Configure output
-  if( compress_output > 0 && cfg.output_file.size() > 3
-      && cfg.output_file.substr(cfg.output_file.size() - 3) != ".gz" )
-    cfg.output_file.append(".gz");
+  if( compress_output > 0 ) {
+    const string ext = (compress_output == 2) ? ".zst" : ".gz";
+    if( cfg.output_file.size() > ext.size() &&
+        cfg.output_file.compare(cfg.output_file.size() - ext.size(),
+                                ext.size(), ext) != 0 )
+      cfg.output_file.append(ext);
+  }
 
-  // Set up nthreads analysis threads. Finished Contexts go into the output queue
-  AnalysisWorker<Context> analysisWorker;
-  QueuingThreadPool<Context> pool(nthreads, analysisWorker);
+  // Open input. Do this before starting any threads so we can bail out
+  // cleanly on error.
+  // With partitioned input, each analysis thread reads its own chunks of
+  // the input file, located via the event index.
+  unique_ptr<PartitionedInput> partitions;
+  if( cfg.nev_chunk > 0 || cfg.parallel_files ) {
+#ifdef EVTORDER
+    if( allow_sync_events )
+      cerr << "Partitioned input does not support event ordering, "
+           << "reading input serially" << endl;
+    else
+#endif
+      partitions = make_unique<PartitionedInput>(
+        cfg.input_files, cfg.read_mode, cfg.first_event, cfg.nev_max,
+        cfg.nev_chunk);
+    if( partitions && partitions->Init() != 0 )
+      return 2;
+  }
+  FileChain inp(cfg.input_files, cfg.read_mode, cfg.read_block_size,
+                cfg.io_threads);
+  if( !partitions && inp.Open() )
+    return 2;
+  // Position at the first requested event. Use the event index if possible.
+  if( !partitions && cfg.first_event > 1 ) {
+    if( inp.LoadIndex() != 0 && debug > 0 )
+      cout << "No complete event index for " << cfg.input_file
+           << ", skipping " << cfg.first_event-1 << " events" << endl;
+    if( inp.SeekEvent(cfg.first_event) != 0 ) {
+      cerr << "Cannot find event " << cfg.first_event << " in "
+           << cfg.input_file << endl;
+      return 2;
+    }
+  }
 
-  // Set up output thread(s). Finished Contexts go back into freeQueue
+  // Set up nthreads analysis threads. Finished Contexts go back into
+  // freeQueue, their output chunks into the output queue
+  using Pool_t = QueuingThreadPool<Context, OutputChunk>;
+  unique_ptr<Pool_t> pool;
+  if( partitions )
+    pool = make_unique<Pool_t>(
+      nthreads, PartitionWorker<Context>(*partitions, freeQueue, freeChunks));
+  else
+    pool = make_unique<Pool_t>(
+      nthreads, AnalysisWorker<Context>(freeQueue));
+
+  // Set up output thread(s). Written chunks go back into freeChunks
 #ifdef OUTPUT_POOL
   QueuingThreadPool<Context> out_pool( 1, outputWorker );
 #else
   // Single output thread
   std::thread output(&OutputWorker<Context>::run,
-                     OutputWorker<Context>(cfg.output_file, freeQueue), &pool);
+                     OutputWorker<Context>(cfg.output_file, freeChunks, schema),
+                     pool.get());
 #endif
 
   ClockTime_t init_duration = HighResClock::now() - init_start;
@@ -471,37 +668,42 @@ int main( int argc, char* const* argv )
 #ifdef EVTORDER
   bool doing_sync = false;
 #endif
-  size_t nev = 0;
+  size_t nev = 0, nbatch = 0;
   if( debug > 0 )
     cout << "Starting event loop, nev_max = " << cfg.nev_max << endl;
 
-  // Open input
-  DataFile inp(cfg.input_file);
-  if( inp.Open() )
-    return 2;
-
-  // Loop: Read one event and hand it off to an idle thread
-  while( inp.ReadEvent() == 0 && nev < cfg.nev_max ) {
+  // Loop: Read events into a context until its batch is full, then hand
+  // it off to an idle thread.
+  // (Partitioned input is read by the analysis threads themselves.)
+  unique_ptr<Context> ctxPtr;
+  while( !partitions && nev < cfg.nev_max && inp.ReadEvent() == 0 ) {
     ++nev;
+    size_t evnum = cfg.first_event + nev - 1;
     if( debug > 1 )
-      cout << "Event " << nev << endl;
+      cout << "Event " << evnum << endl;
     else
       mark_progress(nev);
     // Main processing
 
-    auto ctxPtr = freeQueue.next();
+    if( !ctxPtr ) {
+      ctxPtr = freeQueue.next();
+      ctxPtr->nevents = 0;
+      // Take the output chunk here, in sequence, so that ordered output
+      // never waits for a batch that waits for a chunk
+      ctxPtr->output = freeChunks.next();
+      // Sequence number for event ordering. These must be consecutive
+      ctxPtr->iseq = ++nbatch;
+    }
     Context& ctx = *ctxPtr;
-
-    swap(ctx.evbuffer, inp.GetEvBuffer());
-    ctx.nev = nev;
+    ctx.AddEvent(inp, evnum);
+    if( !ctx.IsFull() )
+      continue;
 
 #ifdef EVTORDER
-    // Sequence number for event ordering. These must be consecutive
-    ctx.iseq = nev;
-
     // Synchronize the event stream at sync events (e.g. scalers).
     // All events before sync events will be processed, followed by
     // the sync event(s), then normal processing resumes.
+    // With sync events, batches hold a single event.
     if( allow_sync_events && (ctx.IsSyncEvent() || doing_sync) ) {
       ctx.WaitAllDone();
       doing_sync = ctx.IsSyncEvent();
@@ -509,25 +711,35 @@ int main( int argc, char* const* argv )
     if( order_events )
       ctx.MarkActive();
 #endif
-    pool.push_work(std::move(ctxPtr));
+    pool->push_work(std::move(ctxPtr));
   }
+  // Last, partially filled batch
+  if( ctxPtr )
+    pool->push_work(std::move(ctxPtr));
+
+  // Terminate worker threads
+  pool->finish();
+
+  if( partitions )
+    nev = nev_partitioned;
   if( cfg.mark != 0 && nev >= cfg.mark )
     cout << endl;
   if( debug > 0 ) {
     cout << "Normal end of file" << endl;
     cout << "Read " << nev << " events" << endl;
+    BufferPool::Instance().Print();
   }
 
+  // Close input only now. With mapped input, the workers access the
+  // event data directly in the file mapping.
+  input_stats += inp.GetIOStats();
   inp.Close();
-
-  // Terminate worker threads
-  pool.finish();
 #ifdef OUTPUT_POOL
   // Terminate output threads
   out_pool.finish();
 #else
   // Terminate single output thread
-  pool.push_result(nullptr);
+  pool->push_result(nullptr);
   output.join();
 #endif
 
@@ -542,7 +754,11 @@ int main( int argc, char* const* argv )
   cout << "Init:      " << init_duration.count()         << " ms" << endl;
   cout << "Analysis:  " << analysis_realtime_sum.count() << " ms" << endl;
   cout << "Output:    " << output_realtime_sum.count()   << " ms" << endl;
+  cout << "Input:     " << input_stats.bytes / 1e6 << " MB, "
+       << input_stats.bytes / 1e3 / run_duration.count() << " MB/s, "
+       << "stalled " << input_stats.stall.count() << " ms" << endl;
   cout << "Total CPU: " << cpu_usage.count()             << " ms" << endl;
   cout << "Real:      " << run_duration.count()          << " ms" << endl;
+  PrintCacheStats(gDets);
   return 0;
 }
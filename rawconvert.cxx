@@ -0,0 +1,104 @@
+// Convert raw data files between the plain (version 1) and blocked
+// (version 2) formats
+//
+// For the file formats, see rawdata.h. The input may be in either format
+// and may be compressed.
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+
+#include "DataFile.h"
+#include "RawWriter.h"
+
+using namespace std;
+
+// Configuration
+struct Config {
+  const char* prgname{""};
+  const char* input_file{""};
+  const char* output_file{""};
+  int debug{0};
+  size_t block_events{RawWriter::DEFAULT_BLOCK_EVENTS};
+  size_t nev_max{SIZE_MAX};
+};
+static Config conf;
+
+// Usage message
+static void usage()
+{
+  cerr << "Usage: " << conf.prgname << " [options] input_file output_file"
+       << endl
+       << "where options are:" << endl
+       << " [ -b nev_block ]\tevents per block (default "
+       << RawWriter::DEFAULT_BLOCK_EVENTS << ", 0 = write version 1 file)"
+       << endl
+       << " [ -n nev_max ]\t\tconvert at most nev_max events" << endl
+       << " [ -d debug_level ]\tset debug level (default 0)" << endl
+       << " [ -h ]\t\t\tprint this help message" << endl;
+  exit(255);
+}
+
+// Command line parser
+void get_args( int argc, char** argv )
+{
+  conf.prgname = argv[0];
+  if( strlen(conf.prgname) >= 2 && strncmp(conf.prgname,"./",2) == 0 )
+    conf.prgname += 2;
+
+  int opt;
+  while( (opt = getopt(argc, argv, "b:d:n:h")) != -1 ) {
+    switch (opt) {
+      case 'b':
+        conf.block_events = stoul(optarg);
+        break;
+      case 'd':
+        conf.debug = stoi(optarg);
+        break;
+      case 'n':
+        conf.nev_max = stoul(optarg);
+        break;
+      case 'h':
+      default:
+        usage();
+        break;
+    }
+  }
+  if( optind+2 > argc ) {
+    cerr << "Input or output file name missing" << endl;
+    usage();
+  }
+  conf.input_file = argv[optind];
+  conf.output_file = argv[optind+1];
+}
+
+int main( int argc, char** argv )
+{
+  get_args(argc, argv);
+
+  DataFile inp(conf.input_file, DataFile::kPrefetch);
+  if( inp.Open() != 0 )
+    return 1;
+  RawWriter writer(conf.block_events);
+  if( writer.Open(conf.output_file) != 0 )
+    return 1;
+
+  int status = 0;
+  while( writer.GetNevents() < conf.nev_max && (status = inp.ReadEvent()) == 0 ) {
+    if( writer.WriteEvent( inp.GetEvBufPtr(), inp.GetEvSize() ) != 0 )
+      return 1;
+  }
+  inp.Close();
+  if( status > 0 || writer.Close() != 0 )
+    return 1;
+
+  cout << "Converted " << writer.GetNevents() << " events from "
+       << conf.input_file << " to " << conf.output_file;
+  if( conf.block_events > 0 )
+    cout << " in " << writer.GetNblocks() << " blocks";
+  cout << endl;
+
+  return 0;
+}
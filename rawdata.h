@@ -8,8 +8,9 @@
 
 using EvDat_t = double;
 
-static constexpr size_t MAXDATA = 16;
-static constexpr size_t MAXMODULES = 8;
+// Bits of EventHeader::event_info
+static constexpr uint32_t EVINFO_NMODULES = 0xFFFFU;   // Number of modules
+static constexpr uint32_t EVINFO_SYNC     = 0x10000U;  // Sync event flag
 
 // For each event
 struct EventHeader {
@@ -20,6 +21,10 @@ struct EventHeader {
   uint32_t event_info;    // info/flags for this event
 } __attribute__((aligned(8)));
 
+// Bits of ModuleHeader::module_number
+static constexpr uint16_t MODNUM_NUMBER = 0x0FFFU;  // Module number
+static constexpr uint16_t MODNUM_PACKED = 0x8000U;  // Payload is packed integers
+
 // For each module in the event
 struct ModuleHeader {
   ModuleHeader() : module_length{0}, module_number{0}, module_ndata{0} {}
@@ -30,16 +35,52 @@ struct ModuleHeader {
   uint16_t module_ndata;  // number of data values for this module
 } __attribute__((aligned(8)));
 
-struct ModuleData {
-  ModuleData() : data{} {}
-  ModuleHeader header;
-  EvDat_t      data[MAXDATA];
-} __attribute__((aligned(128)));
-
-struct Event {
-  Event() : module{} {}
-  EventHeader header;
-  ModuleData* module[MAXMODULES];
-} __attribute__((aligned(128)));
+// Version 2 ("blocked") file layout:
+//   RawFileHeader
+//   any number of blocks, each consisting of
+//     RawBlockHeader
+//     the events of the block, as in version 1
+// Version 1 files are a bare sequence of events. The two are told apart by
+// the first word of the file. Blocks can be checked independently and
+// located without reading the event data.
+
+static constexpr char     RAWFILE_MAGIC[8] = { 'P','P','O','D','D','R','A','W' };
+static constexpr uint32_t RAWFILE_MAGIC_WORD = 0x444F5050U; // "PPOD", little-endian
+static constexpr uint32_t RAWFILE_VERSION = 2;
+static constexpr uint32_t RAWBLOCK_MAGIC = 0x4B4C4250U;     // "PBLK", little-endian
+
+struct RawFileHeader {
+  char     magic[8];      // RAWFILE_MAGIC
+  uint32_t version;       // RAWFILE_VERSION
+  uint32_t header_size;   // Offset of the first block (bytes)
+  uint32_t block_events;  // Nominal number of events per block
+  uint32_t reserved;
+} __attribute__((aligned(8)));
+
+struct RawBlockHeader {
+  uint32_t magic;         // RAWBLOCK_MAGIC
+  uint32_t nevents;       // Number of events in this block
+  uint64_t first_event;   // Number of the first event in this block
+  uint32_t length;        // Length of the event data following this header (bytes)
+  uint32_t crc;           // CRC32C of the event data
+} __attribute__((aligned(8)));
+
+// Module payload encodings:
+//  - By default, the ModuleHeader is followed by module_ndata EvDat_t values.
+//  - With MODNUM_PACKED, it is followed by a PackedHeader and module_ndata
+//    unsigned integers of 'nbits' bits each, stored back to back, starting
+//    at the least significant bit of the first byte. Value i is
+//    offset + scale * code[i]. The module is padded to a multiple of 8 bytes.
+struct PackedHeader {
+  double   offset;        // Value of code 0
+  float    scale;         // Value step per code unit
+  uint32_t nbits;         // Bits per value, 1-32
+} __attribute__((aligned(8)));
+
+// Size of the packed payload, excluding headers and padding (bytes)
+inline size_t PackedSize( size_t ndata, uint32_t nbits )
+{
+  return (ndata * nbits + 7) / 8;
+}
 
 #endif